@@ -29,11 +29,14 @@ SOFTWARE.
 ******************************************************************************/
 
 #include <cstdint>
+#include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 
 #include "torchbox.h"
 #include "basecall.h"
+#include "progress.h"
 #include "misc.h"
 #include "error.h"
 
@@ -58,8 +61,9 @@ static void accept_chunk(const int num_chunks, const chunk_sig_t *chunk_sig, con
     runner->input_tensor.index_put_({num_chunks, 0}, chunk_sig->tensor);
 }
 
-static void call_chunks(
+static void decode_chunks(
     const core_t* core,
+    const torch::Tensor &scores_TNC,
     const std::vector<chunk_res_t *> &results,
     const int runner_idx
 ) {
@@ -67,26 +71,11 @@ static void call_chunks(
     runner_t* runner = (*core->runners)[runner_idx];
     runner_stat_t* ts = (*core->runner_stats)[runner_idx];
 
-    LOG_DEBUG("%s", "basecalling chunks");
-    ts->time_infer -= realtime();
-    auto scores = runner->module->forward(runner->input_tensor.to(runner->tensor_opts.device_opt().value()));
-#ifdef USE_GPU
-    if (runner->device != "cpu") torch::cuda::synchronize(runner->device_idx);
-#endif
-    ts->time_infer += realtime();
-
-    auto scores_TNC = scores;
-    // scores_TNC = scores_TNC.to(torch::kCPU).to(torch::kF32).transpose(0, 1).contiguous();
-    scores_TNC = scores_TNC.transpose(0, 1).contiguous();
-#ifdef USE_GPU
-    if (runner->device != "cpu") torch::cuda::synchronize(runner->device_idx);
-#endif
-
     const int T = scores_TNC.size(0);
     const int N = scores_TNC.size(1);
     const int C = scores_TNC.size(2);
     const int state_len = core->model_config->state_len;
-    int nthreads = core->opt.num_thread / core->runners->size();
+    int nthreads = core->thread_plan.decode;
 
     uint8_t *moves;
     char *sequence;
@@ -114,39 +103,25 @@ static void call_chunks(
 
     LOG_DEBUG("%s", "writing to chunks");
 
-    for (size_t chunk = 0; chunk < results.size(); ++chunk) {
-        size_t idx = chunk * T;
-        results[chunk]->moves = std::vector<uint8_t>(moves + idx, moves + idx + T);
-        size_t num_bases = 0;
-        for (auto move: results[chunk]->moves) {
-            num_bases += move;
-        }
-        if (num_bases > (size_t)T) {
-            ERROR("num bases %zu greater than number of timesteps %d", num_bases, T);
-            exit(EXIT_FAILURE);
-        }
-        results[chunk]->seq = std::string(sequence + idx, num_bases);
-        results[chunk]->qstring = std::string(qstring + idx, num_bases);
-
-        size_t seq_size = strlen(results[chunk]->seq.c_str());
-        size_t qstr_size = strlen(results[chunk]->qstring.c_str());
-
-        if (seq_size == 0) {
-            ERROR("%s", "empty sequence returned by decoder");
-            exit(EXIT_FAILURE);
-        }
+    // a runner walks its reads in order, so the chunks of a batch occupy consecutive arena slots
+    // and the whole decoder output is moved with one copy per array
+    const size_t n = results.size();
+    assert(results[n - 1]->moves == results[0]->moves + (n - 1) * T);
+    memcpy(results[0]->moves, moves, n * T * sizeof(uint8_t));
+    memcpy(results[0]->seq, sequence, n * T * sizeof(char));
+    memcpy(results[0]->qstring, qstring, n * T * sizeof(char));
 
-        if (qstr_size == 0) {
-            ERROR("%s", "empty qstring returned by decoder");
-            exit(EXIT_FAILURE);
+    for (size_t chunk = 0; chunk < n; ++chunk) {
+        const uint8_t *chunk_moves = results[chunk]->moves;
+        size_t num_bases = 0;
+        for (int t = 0; t < T; ++t) {
+            num_bases += chunk_moves[t];
         }
-        
-        if (seq_size != qstr_size) {
-            ERROR("mismatch sequence size of %zu with qstring size of %zu", seq_size, qstr_size);
-            ERROR("seq: %s", results[chunk]->seq.c_str());
-            ERROR("qstring: %s", results[chunk]->qstring.c_str());
+        if (num_bases == 0 || num_bases > (size_t)T) {
+            ERROR("invalid number of bases %zu returned by decoder for %d timesteps", num_bases, T);
             exit(EXIT_FAILURE);
         }
+        results[chunk]->num_bases = num_bases;
     }
     ts->time_decode += realtime();
 
@@ -155,6 +130,69 @@ static void call_chunks(
     free(qstring);
 }
 
+static void* pthread_decode_chunks(void* voidargs) {
+    decode_slot_t* slot = (decode_slot_t*)voidargs;
+    const core_t* core = slot->core;
+    // the decoder's own threads inherit this affinity
+    if ((core->opt.flag & SLORADO_PIN) && (*core->runners)[slot->runner]->device == "cpu") {
+        pin_thread(&core->thread_plan, runner_decode_cpu(&core->thread_plan, slot->runner), core->thread_plan.decode);
+    }
+    decode_chunks(slot->core, slot->scores_TNC, slot->results, slot->runner);
+    pthread_exit(0);
+}
+
+static void wait_decode(decode_slot_t *slot, runner_stat_t *ts) {
+    if (!slot->busy) {
+        return;
+    }
+    ts->time_decode_wait -= realtime();
+    int ret = pthread_join(slot->tid, NULL);
+    NEG_CHK(ret);
+    ts->time_decode_wait += realtime();
+    slot->busy = 0;
+}
+
+static void call_chunks(
+    const core_t* core,
+    const std::vector<chunk_res_t *> &results,
+    const int runner_idx
+) {
+    torch::InferenceMode guard;
+    runner_t* runner = (*core->runners)[runner_idx];
+    runner_stat_t* ts = (*core->runner_stats)[runner_idx];
+
+    LOG_DEBUG("%s", "basecalling chunks");
+    ts->time_infer -= realtime();
+    torch::Tensor input = runner->input_tensor;
+    if (runner->device_input.defined()) {
+        runner->device_input.copy_(runner->input_tensor);
+        input = runner->device_input;
+    }
+    auto scores = runner->module->forward(input);
+
+    // the other slot may still be decoding, this one has been free since it was last waited on
+    decode_slot_t *slot = &runner->slots[runner->cur_slot];
+    if (!slot->scores_TNC.defined() || slot->scores_TNC.sizes() != scores.transpose(0, 1).sizes()) {
+        slot->scores_TNC = torch::empty({scores.size(1), scores.size(0), scores.size(2)}, scores.options());
+    }
+    // transpose on this thread so that it is queued right behind the forward pass on the device
+    slot->scores_TNC.copy_(scores.transpose(0, 1));
+#ifdef USE_GPU
+    if (runner->device != "cpu") torch::cuda::synchronize(runner->device_idx);
+#endif
+    ts->time_infer += realtime();
+
+    // at most one batch is decoded at a time, the previous one must be done before this one is handed over
+    wait_decode(&runner->slots[runner->cur_slot ^ 1], ts);
+
+    slot->results = results;
+    slot->busy = 1;
+    int ret = pthread_create(&slot->tid, NULL, pthread_decode_chunks, (void*)slot);
+    NEG_CHK(ret);
+
+    runner->cur_slot ^= 1;
+}
+
 static void basecall_chunks(
     const core_t* core,
     const int runner_idx,
@@ -171,6 +209,11 @@ static void basecall_chunks(
     ts->time_basecall -= realtime();
     call_chunks(core, results, runner_idx);
     ts->time_basecall += realtime();
+    ts->num_chunks += signals.size();
+    ts->num_batches++;
+    if (core->progress) {
+        progress_add(core->progress->chunks, signals.size());
+    }
 }
 
 static void* pthread_single_basecall(void* voidargs) {
@@ -182,6 +225,11 @@ static void* pthread_single_basecall(void* voidargs) {
     const size_t end = args->end;
     opt_t opt = core->opt;
 
+    // torch's OpenMP team for this thread is created by it and inherits the affinity
+    if ((opt.flag & SLORADO_PIN) && (*core->runners)[runner_idx]->device == "cpu") {
+        pin_thread(&core->thread_plan, runner_torch_cpu(&core->thread_plan, runner_idx), core->thread_plan.torch);
+    }
+
     std::vector<chunk_res_t *> results;
     std::vector<chunk_sig_t *> signals;
 
@@ -199,6 +247,9 @@ static void* pthread_single_basecall(void* voidargs) {
                 signals.clear();
             }
         }
+        if (core->progress && chunks_res.size() > 0) {
+            progress_add(core->progress->samples, db->chunked_samples[read_idx]);
+        }
     }
 
     // leftover chunks
@@ -206,10 +257,56 @@ static void* pthread_single_basecall(void* voidargs) {
         basecall_chunks(core, runner_idx, signals, results);
     }
 
+    runner_t* runner = (*core->runners)[runner_idx];
+    runner_stat_t* ts = (*core->runner_stats)[runner_idx];
+    ts->time_basecall -= realtime();
+    wait_decode(&runner->slots[0], ts);
+    wait_decode(&runner->slots[1], ts);
+    ts->time_basecall += realtime();
+
     pthread_exit(0);
 }
 
+/* give every chunk of the batch its slot in the decoder output arena */
+static void assign_chunk_arena(core_t* core, db_t* db) {
+    chunk_db_t *chunk_db = db->chunk_db;
+    const size_t T = core->chunk_size / core->model_stride;
+
+    size_t n_chunks = 0;
+    for (auto &chunks_res: *chunk_db->chunks_res) {
+        n_chunks += chunks_res.size();
+    }
+
+    if (n_chunks > chunk_db->capacity || T != chunk_db->T) {
+        free(chunk_db->moves);
+        free(chunk_db->sequence);
+        free(chunk_db->qstring);
+        chunk_db->moves = (uint8_t *)malloc(n_chunks * T * sizeof(uint8_t));
+        MALLOC_CHK(chunk_db->moves);
+        chunk_db->sequence = (char *)malloc(n_chunks * T * sizeof(char));
+        MALLOC_CHK(chunk_db->sequence);
+        chunk_db->qstring = (char *)malloc(n_chunks * T * sizeof(char));
+        MALLOC_CHK(chunk_db->qstring);
+        chunk_db->capacity = n_chunks;
+        chunk_db->T = T;
+    }
+
+    size_t k = 0;
+    for (auto &chunks_res: *chunk_db->chunks_res) {
+        for (auto &chunk: chunks_res) {
+            chunk.arena_idx = k;
+            chunk.moves = chunk_db->moves + k * T;
+            chunk.seq = chunk_db->sequence + k * T;
+            chunk.qstring = chunk_db->qstring + k * T;
+            chunk.num_bases = 0;
+            ++k;
+        }
+    }
+}
+
 void basecall_db(core_t* core, db_t* db) {
+    assign_chunk_arena(core, db);
+
     int32_t n_reads = (*db->chunk_db->chunks_res).size();
     int32_t num_threads = (*core->runners).size();
     int32_t step = (n_reads + num_threads - 1) / num_threads;
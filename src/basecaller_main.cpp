@@ -35,11 +35,20 @@ SOFTWARE.
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <string>
+
 #include <openfish/openfish_error.h>
 
 #include "slorado.h"
+#include "output.h"
+#include "zwriter.h"
+#include "profile.h"
+#include "report.h"
+#include "progress.h"
+#include "model_pack.h"
 #include "misc.h"
 #include "error.h"
 
@@ -61,13 +70,35 @@ static struct option long_options[] = {
     {"emit-fastq", required_argument, 0, 0},        //14 toggles emit fastq
     {"gpu_batchsize", required_argument, 0, 'C'},   //15 gpu batchsize - number of chunks loaded at once [512]
     {"flash", required_argument, 0, 0},             //16 toggles flash attention when possible
+    {"profile", required_argument, 0, 0},           //17 load parameters from a profile written by slorado tune
+    {"shared-weights", required_argument, 0, 0},    //18 toggles weights mapped read-only and shared by runners and processes
+    {"threads-torch", required_argument, 0, 0},     //19 torch intra-op threads per runner
+    {"threads-decode", required_argument, 0, 0},    //20 decoder threads per runner
+    {"pin-threads", required_argument, 0, 0},       //21 toggles pinning threads to CPUs
+    {"output-format", required_argument, 0, 0},     //22 fastq, sam or bam [from the -o suffix, fastq]
+    {"emit-moves", required_argument, 0, 0},        //23 toggles the move table in SAM/BAM output
+    {"compress-threads", required_argument, 0, 0},  //24 compression threads for BAM, .gz and .zst output [4]
+    {"compress-level", required_argument, 0, 0},    //25 compression level [6 for BAM and .gz, 3 for .zst]
+    {"summary", required_argument, 0, 0},           //26 write a per-read summary TSV
+    {"min-qscore", required_argument, 0, 0},        //27 reads with a lower mean Q-score go to the fail output [0]
+    {"fail-output", required_argument, 0, 0},       //28 fail output [-o with .fail before the suffix]
+    {"out-shards", required_argument, 0, 0},        //29 split the reads over this many files in the -o directory [1]
+    {"compression", required_argument, 0, 0},       //30 none, gzip or zstd [from the -o suffix]
+    {"write-buffer", required_argument, 0, 0},      //31 bytes formatted per output file before one write [4M]
+    {"rotate-output", required_argument, 0, 0},     //32 start a new output segment every N reads, or N bytes with a K/M/G suffix
+    {"barcode-arrangement", required_argument, 0, 0}, //33 barcode arrangement TOML, demultiplexes the output
+    {"barcode-sequences", required_argument, 0, 0},   //34 FASTA with the barcodes named by the arrangement
+    {"trim-sequences", required_argument, 0, 0},      //35 FASTA with the adapters and primers to trim off the read ends
+    {"report", required_argument, 0, 0},              //36 write a JSON report with the timers and throughput of the run
+    {"progress", required_argument, 0, 0},            //37 print the progress every this many seconds
+    {"status-file", required_argument, 0, 0},         //38 keep the progress in this JSON file
     {0, 0, 0, 0}};
 
 
 static inline void print_help_msg(FILE *fp_help, opt_t opt){
     fprintf(fp_help, "usage: slorado basecaller [model] [data]\n");
     fprintf(fp_help, "positional arguments:\n");
-    fprintf(fp_help, "  model FILE                  the basecaller model to run.\n");
+    fprintf(fp_help, "  model FILE                  the basecaller model to run (model directory or slorado model-pack file).\n");
     fprintf(fp_help, "  data FILE                   the data directory.\n");
     fprintf(fp_help, "\nbasic options:\n");
     fprintf(fp_help, "  -t INT                      number of processing threads [%d]\n", opt.num_thread);
@@ -75,11 +106,34 @@ static inline void print_help_msg(FILE *fp_help, opt_t opt){
     fprintf(fp_help, "  -C INT                      gpu batch size (max number of chunks loaded at once) [%d]\n", opt.gpu_batch_size);
     fprintf(fp_help, "  -B FLOAT[K/M/G]             max number of bytes loaded at once [%.1fM]\n", opt.batch_size_bytes/(float)(1000*1000));
     fprintf(fp_help, "  -o FILE                     output to file [%s]\n", opt.out_path);
+    fprintf(fp_help, "  --output-format STR         fastq, sam or bam (unaligned, with the move table) [from the -o suffix, else fastq]\n");
+    fprintf(fp_help, "  --emit-moves=yes|no         write the move table (mv tag) in SAM/BAM [%s]\n", (opt.flag & SLORADO_EMV) ? "yes" : "no");
+    fprintf(fp_help, "  --compress-threads INT      compression threads for BAM, .gz and .zst output [%d]\n", opt.compress_threads);
+    fprintf(fp_help, "  --compress-level INT        compression level [%d for BAM and .gz, %d for .zst]\n", ZW_BGZF_LEVEL, ZW_ZSTD_LEVEL);
+    fprintf(fp_help, "  --summary FILE              write a per-read summary (read id, samples, trimmed samples, duration, bases, mean Q) as TSV\n");
+    fprintf(fp_help, "  --min-qscore FLOAT          reads with a lower mean Q-score go to the fail output [%.1f]\n", opt.min_qscore);
+    fprintf(fp_help, "  --fail-output FILE          where failing reads go [-o with .fail before the format suffix, dropped for stdout]\n");
+    fprintf(fp_help, "  --out-shards INT            split the reads over INT files in the directory given to -o [%d]\n", opt.out_shards);
+    fprintf(fp_help, "  --compression STR           none, gzip or zstd [from the -o suffix, none]\n");
+    fprintf(fp_help, "  --write-buffer FLOAT[K/M/G] bytes formatted per output file before they are written at once [%.1fM]\n", opt.write_buffer/(float)(1000*1000));
+    fprintf(fp_help, "  --rotate-output INT|SIZE    close the output into a complete segment every INT reads, or SIZE bytes (K/M/G) before compression\n");
+    fprintf(fp_help, "  --barcode-arrangement FILE  classify reads against this barcode arrangement (TOML) into a file per barcode next to -o\n");
+    fprintf(fp_help, "  --barcode-sequences FILE    FASTA with the barcode sequences of the arrangement\n");
+    fprintf(fp_help, "  --trim-sequences FILE       trim the adapter and primer sequences in this FASTA off the read ends\n");
+    fprintf(fp_help, "  --report FILE               write the configuration, timers and throughput of the run as JSON\n");
+    fprintf(fp_help, "  --progress FLOAT            print reads done, rolling samples/s and bases/s, and the ETA every FLOAT seconds\n");
+    fprintf(fp_help, "  --status-file FILE          rewrite FILE with the progress as JSON [every --progress or %.0f seconds]\n", PROGRESS_INTERVAL);
     fprintf(fp_help, "  -c INT                      chunk size [%zu]\n", opt.chunk_size);
     fprintf(fp_help, "  -p INT                      overlap [%d]\n", opt.overlap);
     fprintf(fp_help, "  -x DEVICE                   specify device [%s]\n", opt.device);
+    fprintf(fp_help, "  -r INT                      number of model runners on the CPU [%d]\n", opt.num_runners);
+    fprintf(fp_help, "  --profile FILE              load -C, -c, -t, -r and -x from a profile written by slorado tune\n");
+    fprintf(fp_help, "  --threads-torch INT         torch threads per CPU runner [-t / -r minus the decoder threads]\n");
+    fprintf(fp_help, "  --threads-decode INT        decoder threads per CPU runner [a quarter of -t / -r]\n");
+    fprintf(fp_help, "  --pin-threads=yes|no        pin the threads of each stage to their own CPUs [%s]\n", (opt.flag & SLORADO_PIN) ? "yes" : "no");
     fprintf(fp_help, "  -h                          shows help message and exits\n");
     fprintf(fp_help, "  --flash=yes|no              use flash attention for better performance [%s]\n", (opt.flag & SLORADO_FLS) ? "yes" : "no");
+    fprintf(fp_help, "  --shared-weights=yes|no     map the weights read-only, shared by all CPU runners and processes [%s]\n", (opt.flag & SLORADO_SHW) ? "yes" : "no");
     fprintf(fp_help, "  --verbose INT               verbosity level [%d]\n",(int)get_log_level());
     fprintf(fp_help, "  --version                   print version\n");
     fprintf(fp_help, "\ndebug options:\n");
@@ -136,6 +190,12 @@ int basecaller_main(int argc, char* argv[]) {
             set_openfish_log_level((enum openfish_log_level_opt)v);
         } else if (c == 'x') {
             opt.device = optarg;
+        } else if (c == 'r') {
+            opt.num_runners = atoi(optarg);
+            if (opt.num_runners < 1) {
+                ERROR("Number of runners should larger than 0. You entered %d", opt.num_runners);
+                exit(EXIT_FAILURE);
+            }
         } else if (c == 'c') {
             opt.chunk_size = atoi(optarg);
             if (opt.chunk_size < 1) {
@@ -150,11 +210,6 @@ int basecaller_main(int argc, char* argv[]) {
             }
         } else if (c == 'o') {
             opt.out_path = optarg;
-            opt.out = fopen(opt.out_path, "w");
-            if (opt.out == NULL) {
-                ERROR("Error in opening output file %s: %s\n", opt.out_path, strerror(errno));
-                exit(EXIT_FAILURE);
-            }
         }  else if (c == 'V') {
             fprintf(stdout,"slorado %s\n",SLORADO_VERSION);
             exit(EXIT_SUCCESS);
@@ -168,9 +223,112 @@ int basecaller_main(int argc, char* argv[]) {
             yes_or_no(&opt.flag, SLORADO_EFQ, long_options[longindex].name, optarg, 1);
         } else if (c == 0 && longindex == 16) { // flash attention
             yes_or_no(&opt.flag, SLORADO_FLS, long_options[longindex].name, optarg, 1);
+        } else if (c == 0 && longindex == 17) { // profile, options given after it take precedence
+            load_profile(optarg, &opt);
+        } else if (c == 0 && longindex == 18) { // shared weights
+            yes_or_no(&opt.flag, SLORADO_SHW, long_options[longindex].name, optarg, 1);
+        } else if (c == 0 && (longindex == 19 || longindex == 20)) { // per-stage thread counts
+            int32_t n = atoi(optarg);
+            if (n < 1) {
+                ERROR("Number of threads for --%s should larger than 0. You entered %d", long_options[longindex].name, n);
+                exit(EXIT_FAILURE);
+            }
+            if (longindex == 19) {
+                opt.num_thread_torch = n;
+            } else {
+                opt.num_thread_decode = n;
+            }
+        } else if (c == 0 && longindex == 21) { // pin threads
+            yes_or_no(&opt.flag, SLORADO_PIN, long_options[longindex].name, optarg, 1);
+        } else if (c == 0 && longindex == 22) { // output format
+            opt.out_format = writer_format(optarg);
+            if (opt.out_format < 0) {
+                ERROR("Unknown output format %s, use fastq, sam or bam", optarg);
+                exit(EXIT_FAILURE);
+            }
+        } else if (c == 0 && longindex == 23) { // emit moves
+            yes_or_no(&opt.flag, SLORADO_EMV, long_options[longindex].name, optarg, 1);
+        } else if (c == 0 && longindex == 24) { // compress threads
+            opt.compress_threads = atoi(optarg);
+            if (opt.compress_threads < 1) {
+                ERROR("Number of compression threads should larger than 0. You entered %d", opt.compress_threads);
+                exit(EXIT_FAILURE);
+            }
+        } else if (c == 0 && longindex == 25) { // compress level
+            opt.compress_level = atoi(optarg);
+            if (opt.compress_level < 0) {
+                ERROR("Compression level should not be negative. You entered %d", opt.compress_level);
+                exit(EXIT_FAILURE);
+            }
+        } else if (c == 0 && longindex == 26) { // summary
+            opt.summary_path = optarg;
+        } else if (c == 0 && longindex == 27) { // min qscore
+            opt.min_qscore = atof(optarg);
+            if (opt.min_qscore < 0) {
+                ERROR("Minimum Q-score should not be negative. You entered %f", opt.min_qscore);
+                exit(EXIT_FAILURE);
+            }
+        } else if (c == 0 && longindex == 28) { // fail output
+            opt.fail_path = optarg;
+        } else if (c == 0 && longindex == 29) { // out shards
+            opt.out_shards = atoi(optarg);
+            if (opt.out_shards < 1) {
+                ERROR("Number of output shards should larger than 0. You entered %d", opt.out_shards);
+                exit(EXIT_FAILURE);
+            }
+        } else if (c == 0 && longindex == 30) { // compression
+            if (strcmp(optarg, "none") == 0) {
+                opt.out_codec = ZW_NONE;
+            } else if (strcmp(optarg, "gzip") == 0) {
+                opt.out_codec = ZW_BGZF;
+            } else if (strcmp(optarg, "zstd") == 0) {
+                opt.out_codec = ZW_ZSTD;
+            } else {
+                ERROR("Unknown compression %s, use none, gzip or zstd", optarg);
+                exit(EXIT_FAILURE);
+            }
+        } else if (c == 0 && longindex == 31) { // write buffer
+            opt.write_buffer = mm_parse_num(optarg);
+            if (opt.write_buffer <= 0) {
+                ERROR("%s", "Write buffer size should be larger than 0.");
+                exit(EXIT_FAILURE);
+            }
+        } else if (c == 0 && longindex == 32) { // rotate output, a size suffix means bytes
+            int64_t n = mm_parse_num(optarg);
+            if (n <= 0) {
+                ERROR("%s", "--rotate-output should be larger than 0.");
+                exit(EXIT_FAILURE);
+            }
+            char last = optarg[strlen(optarg) - 1];
+            if (strchr("kKmMgG", last) != NULL) {
+                opt.rotate_bytes = n;
+            } else {
+                opt.rotate_reads = n;
+            }
+        } else if (c == 0 && longindex == 33) { // barcode arrangement
+            opt.barcode_arrangement = optarg;
+        } else if (c == 0 && longindex == 34) { // barcode sequences
+            opt.barcode_sequences = optarg;
+        } else if (c == 0 && longindex == 35) { // trim sequences
+            opt.trim_sequences = optarg;
+        } else if (c == 0 && longindex == 36) { // report
+            opt.report_path = optarg;
+        } else if (c == 0 && longindex == 37) { // progress
+            opt.progress_interval = atof(optarg);
+            if (opt.progress_interval <= 0) {
+                ERROR("Progress interval should be larger than 0. You entered %s", optarg);
+                exit(EXIT_FAILURE);
+            }
+        } else if (c == 0 && longindex == 38) { // status file
+            opt.status_path = optarg;
         }
     }
 
+    if ((opt.barcode_arrangement == NULL) != (opt.barcode_sequences == NULL)) {
+        ERROR("%s", "--barcode-arrangement and --barcode-sequences go together");
+        exit(EXIT_FAILURE);
+    }
+
     size_t max_input_tensor_len = 10000 * 6000; // 10k chunk len, 6k gpu batch size
 
     if ((size_t)opt.chunk_size * opt.gpu_batch_size > max_input_tensor_len) {
@@ -212,23 +370,64 @@ int basecaller_main(int argc, char* argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // GPU runners keep their weights on the device, there is nothing to share on the host
+    char *shared_model = NULL;
+    if (opt.flag & SLORADO_SHW) {
+        if (strcmp(opt.device, "cpu") != 0) {
+            WARNING("%s", "--shared-weights only applies to the cpu, ignored");
+            opt.flag &= ~SLORADO_SHW;
+        } else if (!is_model_pack(model)) {
+            shared_model = shared_model_pack(model);
+            model = shared_model;
+        }
+    }
+
+    std::string cmdline = "slorado";
+    for (int i = 0; i < argc; ++i) {
+        cmdline += std::string(" ") + argv[i];
+    }
+    output_t *output = init_output(&opt, cmdline.c_str());
+    // the stages look at the resolved format, e.g. only SAM and BAM need the move table stitched
+    opt.out_format = output->format;
+
     // print summary
     fprintf(stderr,"\nslorado base-caller version %s\n", SLORADO_VERSION);
     fprintf(stderr,"model path:         %s\n", model);
     fprintf(stderr,"input path:         %s\n", data);
     fprintf(stderr,"output path:        %s\n", opt.out_path == NULL ? "stdout" : opt.out_path);
+    fprintf(stderr,"output format:      %s%s\n", output_format_name(output->format),
+            output->format == WRITER_BAM ? "" : output->codec == ZW_BGZF ? " (bgzf)" : output->codec == ZW_ZSTD ? " (zstd)" : "");
+    if (output->num_shards > 1) {
+        fprintf(stderr,"output shards:      %d\n", output->num_shards);
+    }
+    if (opt.barcode_arrangement) {
+        fprintf(stderr,"barcodes:           %s (%s)\n", opt.barcode_arrangement, opt.barcode_sequences);
+    }
+    if (opt.trim_sequences) {
+        fprintf(stderr,"trim sequences:     %s\n", opt.trim_sequences);
+    }
     fprintf(stderr,"device:             %s\n", opt.device);
     fprintf(stderr,"chunk size:         %zu\n", opt.chunk_size);
     fprintf(stderr,"batch size:         %d\n", opt.batch_size);
     fprintf(stderr,"gpu batch size:     %d\n", opt.gpu_batch_size);
     fprintf(stderr,"no. threads:        %d\n", opt.num_thread);
+    fprintf(stderr,"no. runners:        %d\n", opt.num_runners);
     fprintf(stderr,"overlap:            %d\n", opt.overlap);
-    fprintf(stderr, "\n");
+    fprintf(stderr,"shared weights:     %s\n", (opt.flag & SLORADO_SHW) ? "yes" : "no");
+    if (opt.min_qscore > 0) {
+        fprintf(stderr,"min qscore:         %.1f (fail output: %s)\n", opt.min_qscore, output->fail.fp ? output->fail.path : "dropped");
+    }
 
 /////////////////////////////////////////////////////////////////////////////
 
     // initialise the core data structure
     core_t* core = init_core(data, opt, model, realtime0);
+    print_thread_plan(stderr, &core->thread_plan, core->opt.flag);
+    fprintf(stderr, "\n");
+    core->output = output;
+    if (opt.progress_interval > 0 || opt.status_path != NULL) {
+        core->progress = start_progress(data, opt.progress_interval, opt.progress_interval > 0, opt.status_path, realtime0);
+    }
 
     int32_t counter = 0;
 
@@ -267,9 +466,12 @@ int basecaller_main(int argc, char* argv[]) {
     free_db(db);
 
     fprintf(stderr, "[%s] total entries: %ld", __func__, (long)core->total_reads);
+    if (opt.min_qscore > 0) {
+        fprintf(stderr, "\n[%s] reads below min qscore: %ld", __func__, (long)output->fail_reads);
+    }
     fprintf(stderr, "\n[%s] total bytes: %.1f M", __func__, core->sum_bytes/(float)(1000*1000));
 
-    fprintf(stderr, "\n[%s] model initialization: %.3f sec", __func__, core->time_init_runners);
+    fprintf(stderr, "\n[%s] model initialization: %.3f sec (%.3f sec not overlapped with data loading)", __func__, core->time_init_runners, core->time_wait_runners);
     fprintf(stderr, "\n[%s] data loading: %.3f sec", __func__, core->time_load_db);
     fprintf(stderr, "\n[%s] data processing: %.3f sec", __func__, core->time_process_db);
     fprintf(stderr, "\n[%s]     - parse: %.3f sec", __func__, core->time_parse);
@@ -306,19 +508,31 @@ int basecaller_main(int argc, char* argv[]) {
             // fprintf(stderr, "\n[%s]                     - crf_2: %.3f sec", __func__, model_stats->time_crf_2);
             // fprintf(stderr, "\n[%s]                     - clamp: %.3f sec", __func__, model_stats->time_clamp);
         }
-        fprintf(stderr, "\n[%s]                 - decode: %.3f sec", __func__, runner_stats[i]->time_decode);
+        fprintf(stderr, "\n[%s]                 - waiting on decode: %.3f sec", __func__, runner_stats[i]->time_decode_wait);
+        fprintf(stderr, "\n[%s]             - decode: %.3f sec (%.3f sec overlapped with inference)", __func__, runner_stats[i]->time_decode, runner_stats[i]->time_decode - runner_stats[i]->time_decode_wait);
         // fprintf(stderr, "\n[%s]             - total data points copied: %lu", __func__, runner_stats[i]->total_dp);
     }
     fprintf(stderr, "\n[%s]     - postprocess: %.3f sec", __func__, core->time_postproc);
     fprintf(stderr, "\n[%s] data output: %.3f sec", __func__, core->time_output);
     fprintf(stderr,"\n");
 
+    if (opt.report_path) {
+        write_report(opt.report_path, core, output, model, data, cmdline.c_str(), realtime0);
+    }
+
+    // flush and close every output file
+    free_output(output);
+
+    // the status file says done only once the output is complete
+    if (core->progress) {
+        stop_progress(core->progress);
+        core->progress = NULL;
+    }
+
     // free the core data structure
     free_core(core, opt);
+    free(shared_model);
 
-    if (opt.out != stdout) {
-        fclose(opt.out);
-    }
 
     return 0;
 }
@@ -0,0 +1,277 @@
+/* @file cpu_kernels.cpp
+**
+** hand-written CPU kernels for the model hot spots
+** @@
+******************************************************************************/
+
+#include <math.h>
+#include <stdint.h>
+
+#include "cpu_kernels.h"
+#include "simd.h"
+
+#define SWISH_CLAMP_MAX (3.5f)
+
+static inline float silu(float x) {
+    return x / (1.0f + expf(-x));
+}
+
+static inline float conv1_act(float v, bool clamp) {
+    v = silu(v);
+    return (clamp && v > SWISH_CLAMP_MAX) ? SWISH_CLAMP_MAX : v;
+}
+
+// output position t reads x[t - pad, t - pad + winlen), zero padded outside [0, T)
+static inline void conv1_scalar(const float *x, const float *w, const float *b, float *y, int64_t t, int64_t T, int64_t T_out, int C, int winlen, bool clamp) {
+    const int64_t pad = winlen / 2;
+    for (int c = 0; c < C; ++c) {
+        float acc = b[c];
+        for (int k = 0; k < winlen; ++k) {
+            int64_t pos = t - pad + k;
+            if (pos >= 0 && pos < T) {
+                acc += w[c * winlen + k] * x[pos];
+            }
+        }
+        y[c * T_out + t] = conv1_act(acc, clamp);
+    }
+}
+
+void conv1d_single_channel_cpu(const float *x, const float *w, const float *b, float *y, int64_t n_start, int64_t n_end, int64_t T, int C, int winlen, bool clamp) {
+    const int64_t pad = winlen / 2;
+    const int64_t T_out = T + 2 * pad - winlen + 1;
+    // positions whose whole window lies inside the signal
+    const int64_t t_begin = pad;
+    const int64_t t_end = T - winlen + pad + 1;
+    const vf32_t clamp_max = vf32_set1(SWISH_CLAMP_MAX);
+
+    for (int64_t n = n_start; n < n_end; ++n) {
+        const float *xn = x + n * T;
+        float *yn = y + n * C * T_out;
+
+        int64_t t = 0;
+        for (; t < t_begin && t < T_out; ++t) {
+            conv1_scalar(xn, w, b, yn, t, T, T_out, C, winlen, clamp);
+        }
+
+        // each window of the input is loaded once and reused for every output channel
+        for (; t + VF32_WIDTH <= t_end; t += VF32_WIDTH) {
+            vf32_t xk[CONV1_MAX_WINLEN];
+            for (int k = 0; k < winlen; ++k) {
+                xk[k] = vf32_load(xn + t - pad + k);
+            }
+            for (int c = 0; c < C; ++c) {
+                const float *wc = w + c * winlen;
+                vf32_t acc = vf32_set1(b[c]);
+                for (int k = 0; k < winlen; ++k) {
+                    acc += vf32_set1(wc[k]) * xk[k];
+                }
+                acc = vf32_silu(acc);
+                if (clamp) {
+                    acc = vf32_min(acc, clamp_max);
+                }
+                vf32_store(yn + c * T_out + t, acc);
+            }
+        }
+
+        for (; t < T_out; ++t) {
+            conv1_scalar(xn, w, b, yn, t, T, T_out, C, winlen, clamp);
+        }
+    }
+}
+
+void rotary_emb_cpu(float *x, const float *sin_buf, const float *cos_buf, int64_t row_start, int64_t row_end, int64_t seqlen, int nheads, int rotary_half, int64_t stride_batch, int64_t stride_seq, int64_t stride_head) {
+    for (int64_t row = row_start; row < row_end; ++row) {
+        const int64_t n = row / seqlen;
+        const int64_t t = row % seqlen;
+        const float *sin_t = sin_buf + t * rotary_half;
+        const float *cos_t = cos_buf + t * rotary_half;
+        float *xr = x + n * stride_batch + t * stride_seq;
+
+        for (int h = 0; h < nheads; ++h) {
+            float *x1 = xr + h * stride_head;
+            float *x2 = x1 + rotary_half;
+
+            int i = 0;
+            for (; i + VF32_WIDTH <= rotary_half; i += VF32_WIDTH) {
+                const vf32_t a = vf32_load(x1 + i);
+                const vf32_t b = vf32_load(x2 + i);
+                const vf32_t c = vf32_load(cos_t + i);
+                const vf32_t s = vf32_load(sin_t + i);
+                vf32_store(x1 + i, a * c - b * s);
+                vf32_store(x2 + i, b * c + a * s);
+            }
+            for (; i < rotary_half; ++i) {
+                const float a = x1[i];
+                const float b = x2[i];
+                x1[i] = a * cos_t[i] - b * sin_t[i];
+                x2[i] = b * cos_t[i] + a * sin_t[i];
+            }
+        }
+    }
+}
+
+#define ATTN_K_TILE 32
+
+void window_attention_cpu(const float *qkv, float *out, int64_t item_start, int64_t item_end, int64_t T, int nheads, int head_dim, int win_upper, int win_lower, int64_t stride_batch, int64_t stride_seq, int64_t stride_qkv, int64_t stride_head) {
+    const int64_t n_qblocks = (T + ATTN_Q_BLOCK - 1) / ATTN_Q_BLOCK;
+    const int dvec = head_dim / VF32_WIDTH;
+    const float scale = 1.0f / sqrtf((float)head_dim);
+
+    vf32_t q[ATTN_MAX_HEAD_DIM / VF32_WIDTH];
+    vf32_t acc[ATTN_MAX_HEAD_DIM / VF32_WIDTH];
+    float s[ATTN_K_TILE];
+
+    for (int64_t item = item_start; item < item_end; ++item) {
+        const int64_t qblock = item % n_qblocks;
+        const int64_t h = (item / n_qblocks) % nheads;
+        const int64_t n = item / (n_qblocks * nheads);
+
+        const float *base = qkv + n * stride_batch + h * stride_head;
+        const int64_t qb = qblock * ATTN_Q_BLOCK;
+        const int64_t qe = qb + ATTN_Q_BLOCK < T ? qb + ATTN_Q_BLOCK : T;
+
+        for (int64_t i = qb; i < qe; ++i) {
+            const float *qi = base + i * stride_seq;
+            for (int d = 0; d < dvec; ++d) {
+                q[d] = vf32_load(qi + d * VF32_WIDTH) * vf32_set1(scale);
+                acc[d] = vf32_set1(0.0f);
+            }
+
+            const int64_t lo = i - win_upper > 0 ? i - win_upper : 0;
+            const int64_t hi = i + win_lower < T - 1 ? i + win_lower : T - 1;
+            float m = -INFINITY;
+            float l = 0.0f;
+
+            for (int64_t j0 = lo; j0 <= hi; j0 += ATTN_K_TILE) {
+                const int nk = (int)(hi + 1 - j0 < ATTN_K_TILE ? hi + 1 - j0 : ATTN_K_TILE);
+
+                float tile_max = -INFINITY;
+                for (int j = 0; j < nk; ++j) {
+                    const float *kj = base + stride_qkv + (j0 + j) * stride_seq;
+                    vf32_t dot = vf32_set1(0.0f);
+                    for (int d = 0; d < dvec; ++d) {
+                        dot += q[d] * vf32_load(kj + d * VF32_WIDTH);
+                    }
+                    s[j] = vf32_hsum(dot);
+                    tile_max = s[j] > tile_max ? s[j] : tile_max;
+                }
+
+                // rescale what has been accumulated so far to the new running maximum
+                const float m_new = tile_max > m ? tile_max : m;
+                const float corr = expf(m - m_new);
+                l *= corr;
+                for (int d = 0; d < dvec; ++d) {
+                    acc[d] *= vf32_set1(corr);
+                }
+                m = m_new;
+
+                int j = 0;
+                for (; j + VF32_WIDTH <= nk; j += VF32_WIDTH) {
+                    vf32_store(s + j, vf32_exp(vf32_load(s + j) - vf32_set1(m)));
+                }
+                for (; j < nk; ++j) {
+                    s[j] = expf(s[j] - m);
+                }
+
+                for (j = 0; j < nk; ++j) {
+                    const float *vj = base + 2 * stride_qkv + (j0 + j) * stride_seq;
+                    const vf32_t p = vf32_set1(s[j]);
+                    l += s[j];
+                    for (int d = 0; d < dvec; ++d) {
+                        acc[d] += p * vf32_load(vj + d * VF32_WIDTH);
+                    }
+                }
+            }
+
+            float *oi = out + ((n * T + i) * nheads + h) * head_dim;
+            const vf32_t inv_l = vf32_set1(1.0f / l);
+            for (int d = 0; d < dvec; ++d) {
+                vf32_store(oi + d * VF32_WIDTH, acc[d] * inv_l);
+            }
+        }
+    }
+}
+
+void gated_silu_cpu(const float *h, float *out, int64_t rows, int hidden) {
+    for (int64_t r = 0; r < rows; ++r) {
+        const float *y = h + r * 2 * hidden;
+        const float *gate = y + hidden;
+        float *o = out + r * hidden;
+
+        int i = 0;
+        for (; i + VF32_WIDTH <= hidden; i += VF32_WIDTH) {
+            vf32_store(o + i, vf32_silu(vf32_load(gate + i)) * vf32_load(y + i));
+        }
+        for (; i < hidden; ++i) {
+            o[i] = silu(gate[i]) * y[i];
+        }
+    }
+}
+
+void deepnorm_rms_norm_cpu(const float *in, const float *residual, const float *weight, float *out, int64_t row_start, int64_t row_end, int dim, float alpha, float eps) {
+    const vf32_t alpha_v = vf32_set1(alpha);
+
+    for (int64_t r = row_start; r < row_end; ++r) {
+        const float *ir = in + r * dim;
+        const float *xr = residual + r * dim;
+        float *orow = out + r * dim;
+
+        // scaled residual add, keeping the sum of squares
+        vf32_t sq = vf32_set1(0.0f);
+        int i = 0;
+        for (; i + VF32_WIDTH <= dim; i += VF32_WIDTH) {
+            const vf32_t k = vf32_load(ir + i) + vf32_load(xr + i) * alpha_v;
+            sq += k * k;
+            vf32_store(orow + i, k);
+        }
+        float sum_sq = vf32_hsum(sq);
+        for (; i < dim; ++i) {
+            const float k = ir[i] + xr[i] * alpha;
+            sum_sq += k * k;
+            orow[i] = k;
+        }
+
+        // the row is still in L1, scale it in place
+        const float rstd = 1.0f / sqrtf(sum_sq / dim + eps);
+        const vf32_t rstd_v = vf32_set1(rstd);
+        i = 0;
+        for (; i + VF32_WIDTH <= dim; i += VF32_WIDTH) {
+            vf32_store(orow + i, vf32_load(orow + i) * rstd_v * vf32_load(weight + i));
+        }
+        for (; i < dim; ++i) {
+            orow[i] = orow[i] * rstd * weight[i];
+        }
+    }
+}
+
+#define QSCORE_BLOCK 4096 // characters summed in float lanes before the partial sum moves to double
+
+float mean_qscore_cpu(const char *qstring, int64_t len) {
+    if (len <= 0) {
+        return 0.0f;
+    }
+    // 10^(-q/10) = exp(-q * ln(10) / 10) with q = c - 33
+    const float k = -0.230258509299404568f;
+    const vf32_t k_v = vf32_set1(k);
+    const vf32_t offset_v = vf32_set1(33.0f);
+
+    double sum = 0.0;
+    for (int64_t start = 0; start < len; start += QSCORE_BLOCK) {
+        const int64_t end = start + QSCORE_BLOCK < len ? start + QSCORE_BLOCK : len;
+        vf32_t acc = vf32_set1(0.0f);
+        int64_t i = start;
+        for (; i + VF32_WIDTH <= end; i += VF32_WIDTH) {
+            const uint8_t *c = (const uint8_t *)qstring + i;
+            vi32_t ci = {c[0], c[1], c[2], c[3]};
+            acc += vf32_exp((__builtin_convertvector(ci, vf32_t) - offset_v) * k_v);
+        }
+        float tail = 0.0f;
+        for (; i < end; ++i) {
+            tail += expf(((uint8_t)qstring[i] - 33) * k);
+        }
+        sum += vf32_hsum(acc) + tail;
+    }
+
+    float q = -10.0f * log10f((float)(sum / len));
+    return q < 1.0f ? 1.0f : (q > 50.0f ? 50.0f : q);
+}
@@ -0,0 +1,90 @@
+/* @file cpu_kernels.h
+**
+** hand-written CPU kernels for the model hot spots (fp32, raw pointers, no torch dependency)
+** callers are responsible for splitting work across threads
+** @@
+******************************************************************************/
+
+#ifndef CPU_KERNELS_H
+#define CPU_KERNELS_H
+
+#include <stdint.h>
+
+#define CONV1_MAX_WINLEN 16 // largest kernel the single channel convolution keeps in registers
+#define ATTN_MAX_HEAD_DIM 256 // largest head the window attention keeps on the stack
+#define ATTN_Q_BLOCK 32 // queries per work item, neighbouring queries share most of their keys
+#define GATED_MLP_TILE 128 // rows of the feed-forward intermediate alive at once per thread
+
+/* first convolution layer (insize 1, stride 1, padding winlen/2) with the swish activation fused
+   x: [N, T] input chunks, w: [C, winlen], b: [C], y: [N, C, T_out] for batch entries [n_start, n_end) */
+void conv1d_single_channel_cpu(
+    const float *x,
+    const float *w,
+    const float *b,
+    float *y,
+    int64_t n_start,
+    int64_t n_end,
+    int64_t T,
+    int C,
+    int winlen,
+    bool clamp
+);
+
+/* rotary embedding applied in place to the q or k slice of a strided [N, T, 3, H, D] qkv tensor
+   the first rotary_half features of each head are rotated against the next rotary_half
+   sin_buf/cos_buf: [max_seq_len, rotary_half], rows are (n, t) pairs flattened as n * seqlen + t */
+void rotary_emb_cpu(
+    float *x,
+    const float *sin_buf,
+    const float *cos_buf,
+    int64_t row_start,
+    int64_t row_end,
+    int64_t seqlen,
+    int nheads,
+    int rotary_half,
+    int64_t stride_batch,
+    int64_t stride_seq,
+    int64_t stride_head
+);
+
+/* sliding window attention over a strided [N, T, 3, H, D] qkv tensor, query i only attends to keys
+   [i - win_upper, i + win_lower] with an online softmax, so neither a mask nor a T x T score matrix exist
+   out: [N, T, H, D], work items are (n, h, block of ATTN_Q_BLOCK queries) flattened in that order */
+void window_attention_cpu(
+    const float *qkv,
+    float *out,
+    int64_t item_start,
+    int64_t item_end,
+    int64_t T,
+    int nheads,
+    int head_dim,
+    int win_upper,
+    int win_lower,
+    int64_t stride_batch,
+    int64_t stride_seq,
+    int64_t stride_qkv,
+    int64_t stride_head
+);
+
+/* gated MLP epilogue: h: [rows, 2 * hidden] fc1 output laid out as [y | gate], out: [rows, hidden] = silu(gate) * y */
+void gated_silu_cpu(const float *h, float *out, int64_t rows, int hidden);
+
+/* out = rms_norm(in + alpha * residual) * weight over rows of dim features, each row is read and written once
+   in/residual/out: [rows, dim], weight: [dim], rows [row_start, row_end) */
+void deepnorm_rms_norm_cpu(
+    const float *in,
+    const float *residual,
+    const float *weight,
+    float *out,
+    int64_t row_start,
+    int64_t row_end,
+    int dim,
+    float alpha,
+    float eps
+);
+
+/* mean Q-score of a phred+33 qstring: the mean error probability converted back to phred, clamped to [1, 50]
+   0 for an empty string */
+float mean_qscore_cpu(const char *qstring, int64_t len);
+
+#endif
@@ -0,0 +1,233 @@
+/* @file demux.cpp
+**
+** barcode classification of basecalled reads against a barcode arrangement
+** each barcode with its flanks is searched for near the read ends with Myers' bit-parallel edit distance (myers.h)
+** @@
+******************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <toml.h>
+
+#include "demux.h"
+#include "myers.h"
+#include "error.h"
+
+struct barcode_kit {
+    std::string name;
+    std::vector<std::string> names;
+    std::vector<myers_pattern_t> fwd;     // front flank + barcode + rear flank, searched near the read start
+    std::vector<myers_pattern_t> rc;      // reverse complement, searched near the read end
+
+    int max_penalty;                // edits allowed over the flanks and the barcode together
+    int min_penalty_dist;           // the best barcode must beat the second best by this many edits
+    int end_proximity;              // bases past the pattern length searched at each end
+    int window;                     // bases encoded at each end, enough for the longest pattern
+};
+
+static std::string reverse_complement(const std::string &s) {
+    std::string rc(s.rbegin(), s.rend());
+    for (size_t i = 0; i < rc.size(); ++i) {
+        rc[i] = myers_complement(rc[i]);
+    }
+    return rc;
+}
+
+static std::string toml_string_required(toml_table_t *table, const char *key, const char *path) {
+    toml_datum_t datum = toml_string_in(table, key);
+    if (!datum.ok) {
+        ERROR("barcode arrangement %s has no %s", path, key);
+        exit(EXIT_FAILURE);
+    }
+    std::string s = datum.u.s;
+    free(datum.u.s);
+    return s;
+}
+
+static int64_t toml_int_default(toml_table_t *table, const char *key, int64_t def) {
+    if (table == NULL) {
+        return def;
+    }
+    toml_datum_t datum = toml_int_in(table, key);
+    return datum.ok ? datum.u.i : def;
+}
+
+/* the barcode name pattern is used as a printf format for the index, so it must hold exactly one %d or %i
+   (with optional flags and width) and nothing else but %% */
+static bool valid_name_pattern(const std::string &pattern) {
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%') {
+            continue;
+        }
+        if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+            ++i;
+            continue;
+        }
+        ++i;
+        while (i < pattern.size() && strchr("-+ #0", pattern[i])) {
+            ++i;
+        }
+        while (i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9') {
+            ++i;
+        }
+        if (i == pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i')) {
+            return false;
+        }
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+static std::unordered_map<std::string, std::string> read_fasta(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        ERROR("cannot open barcode sequences - %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    std::unordered_map<std::string, std::string> seqs;
+    std::string name;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '>') {
+            name = line + 1;
+            name = name.substr(0, name.find_first_of(" \t"));
+            seqs[name] = "";
+        } else if (!name.empty()) {
+            seqs[name] += line;
+        }
+    }
+    fclose(fp);
+    return seqs;
+}
+
+barcode_kit_t *load_barcode_kit(const char *arrangement, const char *sequences) {
+    char errbuf[200];
+
+    FILE *fp = fopen(arrangement, "r");
+    if (!fp) {
+        ERROR("cannot open barcode arrangement - %s: %s", arrangement, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    toml_table_t *toml = toml_parse_file(fp, errbuf, sizeof(errbuf));
+    fclose(fp);
+    if (!toml) {
+        ERROR("cannot parse barcode arrangement - %s: %s", arrangement, errbuf);
+        exit(EXIT_FAILURE);
+    }
+    toml_table_t *arr = toml_table_in(toml, "arrangement");
+    if (!arr) {
+        ERROR("barcode arrangement %s has no [arrangement] table", arrangement);
+        exit(EXIT_FAILURE);
+    }
+    toml_table_t *scoring = toml_table_in(toml, "scoring");
+
+    barcode_kit_t *kit = new barcode_kit_t;
+    kit->window = 0;
+    kit->name = toml_string_required(arr, "name", arrangement);
+    const std::string front = toml_string_required(arr, "mask1_front", arrangement);
+    const std::string rear = toml_string_required(arr, "mask1_rear", arrangement);
+    const std::string name_pattern = toml_string_required(arr, "barcode1_pattern", arrangement);
+    if (!valid_name_pattern(name_pattern)) {
+        ERROR("barcode1_pattern \"%s\" of %s should hold exactly one integer conversion such as %%02i", name_pattern.c_str(), arrangement);
+        exit(EXIT_FAILURE);
+    }
+    const int64_t first = toml_int_default(arr, "first_index", -1);
+    const int64_t last = toml_int_default(arr, "last_index", -1);
+    if (first < 0 || last < first) {
+        ERROR("barcode arrangement %s needs first_index <= last_index", arrangement);
+        exit(EXIT_FAILURE);
+    }
+    kit->max_penalty = toml_int_default(scoring, "max_barcode_penalty", 11);
+    kit->min_penalty_dist = toml_int_default(scoring, "min_barcode_penalty_dist", 3);
+    kit->end_proximity = toml_int_default(scoring, "barcode_end_proximity", 75);
+    toml_free(toml);
+
+    std::unordered_map<std::string, std::string> seqs = read_fasta(sequences);
+    for (int64_t i = first; i <= last; ++i) {
+        char name[256];
+        snprintf(name, sizeof(name), name_pattern.c_str(), (int)i);
+        auto it = seqs.find(name);
+        if (it == seqs.end()) {
+            ERROR("barcode %s of %s is not in %s", name, arrangement, sequences);
+            exit(EXIT_FAILURE);
+        }
+        const std::string pattern = front + it->second + rear;
+        if (pattern.size() > BARCODE_MAX_PATTERN) {
+            ERROR("barcode %s with its flanks is %zu bases, at most %d are supported", name, pattern.size(), BARCODE_MAX_PATTERN);
+            exit(EXIT_FAILURE);
+        }
+        kit->names.push_back(name);
+        kit->fwd.push_back(myers_make_pattern(pattern.data(), pattern.size()));
+        const std::string rc = reverse_complement(pattern);
+        kit->rc.push_back(myers_make_pattern(rc.data(), rc.size()));
+        const int window = kit->end_proximity + (int)pattern.size();
+        kit->window = window > kit->window ? window : kit->window;
+    }
+
+    return kit;
+}
+
+void free_barcode_kit(barcode_kit_t *kit) {
+    delete kit;
+}
+
+int32_t classify_barcode(const barcode_kit_t *kit, const char *seq, size_t len) {
+    const size_t front_len = len < (size_t)kit->window ? len : (size_t)kit->window;
+    const size_t rear_start = len - front_len;
+
+    // both ends are encoded once and searched for every barcode
+    std::vector<uint8_t> f(front_len);
+    std::vector<uint8_t> r(front_len);
+    for (size_t i = 0; i < front_len; ++i) {
+        f[i] = myers_base_code(seq[i]);
+        r[i] = myers_base_code(seq[rear_start + i]);
+    }
+
+    int best = BARCODE_MAX_PATTERN + 1;
+    int second = best;
+    int32_t best_index = BARCODE_UNCLASSIFIED;
+    for (size_t b = 0; b < kit->names.size(); ++b) {
+        // each barcode is searched end_proximity bases past its own length, the rear window ends at the read end
+        const size_t w = (size_t)(kit->end_proximity + kit->fwd[b].len);
+        const size_t n = front_len < w ? front_len : w;
+        int d = myers_search(&kit->fwd[b], f.data(), n, NULL);
+        int d_rear = myers_search(&kit->rc[b], r.data() + front_len - n, n, NULL);
+        d = d_rear < d ? d_rear : d;
+        if (d < best) {
+            second = best;
+            best = d;
+            best_index = b;
+        } else if (d < second) {
+            second = d;
+        }
+    }
+
+    if (best > kit->max_penalty || second - best < kit->min_penalty_dist) {
+        return BARCODE_UNCLASSIFIED;
+    }
+    return best_index;
+}
+
+const char *barcode_name(const barcode_kit_t *kit, int32_t barcode) {
+    if (barcode < 0) {
+        return BARCODE_UNCLASSIFIED_NAME;
+    }
+    return kit->names[barcode].c_str();
+}
+
+int32_t barcode_kit_size(const barcode_kit_t *kit) {
+    return kit->names.size();
+}
+
+const char *barcode_kit_name(const barcode_kit_t *kit) {
+    return kit->name.c_str();
+}
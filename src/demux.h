@@ -0,0 +1,36 @@
+/* @file demux.h
+**
+** barcode classification of basecalled reads against a barcode arrangement
+** @@
+******************************************************************************/
+
+#ifndef DEMUX_H
+#define DEMUX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BARCODE_NONE -2            // no arrangement given
+#define BARCODE_UNCLASSIFIED -1
+#define BARCODE_MAX_PATTERN 64     // flanks and barcode have to fit in one machine word, MYERS_MAX_PATTERN
+#define BARCODE_UNCLASSIFIED_NAME "unclassified"
+
+typedef struct barcode_kit barcode_kit_t;
+
+/* load an arrangement TOML (the [arrangement] and [scoring] tables of a dorado custom kit) and the barcode
+   sequences it names from a FASTA file */
+barcode_kit_t *load_barcode_kit(const char *arrangement, const char *sequences);
+
+void free_barcode_kit(barcode_kit_t *kit);
+
+/* index of the barcode found on the flanks of seq, BARCODE_UNCLASSIFIED when none is close and unambiguous enough */
+int32_t classify_barcode(const barcode_kit_t *kit, const char *seq, size_t len);
+
+/* name of barcode index, BARCODE_UNCLASSIFIED_NAME for BARCODE_UNCLASSIFIED */
+const char *barcode_name(const barcode_kit_t *kit, int32_t barcode);
+
+int32_t barcode_kit_size(const barcode_kit_t *kit);
+
+const char *barcode_kit_name(const barcode_kit_t *kit);
+
+#endif
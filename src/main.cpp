@@ -40,11 +40,15 @@ SOFTWARE.
 #include "slorado.h"
 
 int basecaller_main(int argc, char* argv[]);
+int tune_main(int argc, char* argv[]);
+int model_pack_main(int argc, char* argv[]);
 
 int print_usage(FILE *fp_help) {
     fprintf(fp_help,"Usage: slorado <command> [options]\n\n");
     fprintf(fp_help,"command:\n");
     fprintf(fp_help,"         basecaller      basecall S/BLOW5 file\n");
+    fprintf(fp_help,"         tune            find the fastest basecaller parameters for a model on this host\n");
+    fprintf(fp_help,"         model-pack      bundle a model directory into a single file for fast loading\n");
 
     if (fp_help == stderr) {
         return(EXIT_FAILURE);
@@ -64,6 +68,10 @@ int main(int argc, char* argv[]) {
         return print_usage(stderr);
     } else if (strcmp(argv[1], "basecaller") == 0){
         ret = basecaller_main(argc-1, argv+1);
+    } else if (strcmp(argv[1], "tune") == 0){
+        ret = tune_main(argc-1, argv+1);
+    } else if (strcmp(argv[1], "model-pack") == 0){
+        ret = model_pack_main(argc-1, argv+1);
     } else if (strcmp(argv[1], "--version") == 0 || strcmp(argv[1], "-V") == 0){
         fprintf(stdout,"slorado %s\n",SLORADO_VERSION);
         exit(EXIT_SUCCESS);
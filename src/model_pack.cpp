@@ -0,0 +1,140 @@
+/* @file model_pack.cpp
+**
+** single-file model format written by slorado model-pack
+** @@
+******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "model_pack.h"
+#include "error.h"
+
+// runners are initialised in parallel and all ask for the same pack
+static pthread_mutex_t packs_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<model_pack_t *> packs;
+
+bool is_model_pack(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+    char magic[8];
+    size_t n = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+
+    return n == sizeof(magic) && memcmp(magic, MODEL_PACK_MAGIC, sizeof(magic)) == 0;
+}
+
+static model_pack_t *model_pack_map(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ERROR("cannot open model pack %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ERROR("cannot stat model pack %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(model_pack_header_t)) {
+        ERROR("model pack %s is truncated", path);
+        exit(EXIT_FAILURE);
+    }
+
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        ERROR("cannot map model pack %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    model_pack_t *pack = (model_pack_t *)malloc(sizeof(model_pack_t));
+    MALLOC_CHK(pack);
+    pack->path = strdup(path);
+    MALLOC_CHK(pack->path);
+    pack->base = (uint8_t *)base;
+    pack->size = size;
+    pack->header = (const model_pack_header_t *)base;
+
+    const model_pack_header_t *h = pack->header;
+    if (memcmp(h->magic, MODEL_PACK_MAGIC, sizeof(h->magic)) != 0 || h->version != MODEL_PACK_VERSION) {
+        ERROR("%s is not a version %d model pack, run slorado model-pack again", path, MODEL_PACK_VERSION);
+        exit(EXIT_FAILURE);
+    }
+    if (h->config_offset + h->config_len + 1 > size || h->table_offset + h->n_tensors * sizeof(model_pack_entry_t) > size
+            || pack->base[h->config_offset + h->config_len] != '\0') {
+        ERROR("model pack %s is truncated", path);
+        exit(EXIT_FAILURE);
+    }
+    pack->table = (const model_pack_entry_t *)(pack->base + h->table_offset);
+    for (uint32_t i = 0; i < h->n_tensors; ++i) {
+        if (pack->table[i].offset + pack->table[i].nbytes > size) {
+            ERROR("model pack %s is truncated", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // weights are read once per runner at load, ask for them ahead of time
+    madvise(base, size, MADV_WILLNEED);
+
+    return pack;
+}
+
+model_pack_t *model_pack_get(const char *path) {
+    if (!is_model_pack(path)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&packs_lock);
+    model_pack_t *pack = NULL;
+    for (auto p : packs) {
+        if (strcmp(p->path, path) == 0) {
+            pack = p;
+            break;
+        }
+    }
+    if (pack == NULL) {
+        pack = model_pack_map(path);
+        packs.push_back(pack);
+    }
+    pthread_mutex_unlock(&packs_lock);
+
+    return pack;
+}
+
+const model_pack_entry_t *model_pack_find(const model_pack_t *pack, const char *name) {
+    for (uint32_t i = 0; i < pack->header->n_tensors; ++i) {
+        if (strncmp(pack->table[i].name, name, MODEL_PACK_MAX_NAME) == 0) {
+            return &pack->table[i];
+        }
+    }
+    return NULL;
+}
+
+void model_pack_close_all(void) {
+    pthread_mutex_lock(&packs_lock);
+    for (auto p : packs) {
+        munmap(p->base, p->size);
+        free(p->path);
+        free(p);
+    }
+    packs.clear();
+    pthread_mutex_unlock(&packs_lock);
+}
@@ -0,0 +1,72 @@
+/* @file model_pack.h
+**
+** single-file model format written by slorado model-pack
+** layout: header | config.toml text | tensor table | tensor data, every section MODEL_PACK_ALIGN aligned
+** the file is mapped read-only and tensors are used straight from the page cache
+** @@
+******************************************************************************/
+
+#ifndef MODEL_PACK_H
+#define MODEL_PACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MODEL_PACK_MAGIC "SLOPACK1"
+#define MODEL_PACK_VERSION 1
+#define MODEL_PACK_ALIGN 64
+#define MODEL_PACK_MAX_NAME 120
+#define MODEL_PACK_MAX_DIMS 6
+
+// tensor data types in the pack
+#define MODEL_PACK_F32 0
+#define MODEL_PACK_F16 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_tensors;
+    uint64_t config_offset;     // config.toml text, null terminated
+    uint64_t config_len;
+    uint64_t table_offset;      // n_tensors model_pack_entry_t
+    char model_name[256];       // name of the model directory the pack was made from
+} model_pack_header_t;
+
+typedef struct {
+    char name[MODEL_PACK_MAX_NAME]; // file name in the model directory, e.g. crf.linear.weight.tensor
+    uint32_t dtype;
+    uint32_t ndim;
+    int64_t shape[MODEL_PACK_MAX_DIMS];
+    uint64_t offset;            // from the start of the file
+    uint64_t nbytes;
+} model_pack_entry_t;
+
+typedef struct {
+    char *path;
+    uint8_t *base;              // mapping of the whole file
+    size_t size;
+    const model_pack_header_t *header;
+    const model_pack_entry_t *table;
+} model_pack_t;
+
+/* check whether path is a model pack rather than a model directory */
+bool is_model_pack(const char *path);
+
+/* map a model pack, each path is mapped once per process and stays mapped until model_pack_close_all
+   returns NULL if path is not a model pack */
+model_pack_t *model_pack_get(const char *path);
+
+/* look up a tensor by its file name, NULL if absent */
+const model_pack_entry_t *model_pack_find(const model_pack_t *pack, const char *name);
+
+/* unmap every pack mapped by model_pack_get */
+void model_pack_close_all(void);
+
+/* write a pack of the model directory, returns the bytes of tensor data written (model_pack_main.cpp) */
+uint64_t write_model_pack(const char *model, const char *out, uint32_t pack_dtype);
+
+/* path of a float32 pack of the model directory in shared memory (SLORADO_SHM_DIR, default /dev/shm),
+   written on first use so that every process on the node maps the same pages */
+char *shared_model_pack(const char *model);
+
+#endif
@@ -0,0 +1,291 @@
+/* @file model_pack_main.cpp
+**
+** slorado model-pack: bundle a model directory (config.toml + *.tensor) into a single mmap-able file
+** @@
+******************************************************************************/
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include "slorado.h"
+#include "model_pack.h"
+#include "misc.h"
+#include "error.h"
+
+static struct option long_options[] = {
+    {"dtype", required_argument, 0, 'd'},           //0 tensor type in the pack [float32]
+    {"help", no_argument, 0, 'h'},                  //1
+    {0, 0, 0, 0}};
+
+static inline void print_help_msg(FILE *fp_help) {
+    fprintf(fp_help, "usage: slorado model-pack [model] [out]\n");
+    fprintf(fp_help, "positional arguments:\n");
+    fprintf(fp_help, "  model DIR                   the model directory (config.toml and *.tensor files).\n");
+    fprintf(fp_help, "  out FILE                    the model pack to write.\n");
+    fprintf(fp_help, "\nbasic options:\n");
+    fprintf(fp_help, "  -d float32|float16          type the weights are stored as, match the runner (cpu: float32, gpu: float16) [float32]\n");
+    fprintf(fp_help, "  -h                          shows help message and exits\n");
+}
+
+static uint64_t align_up(uint64_t x) {
+    return (x + MODEL_PACK_ALIGN - 1) / MODEL_PACK_ALIGN * MODEL_PACK_ALIGN;
+}
+
+static void write_at(FILE *fp, uint64_t offset, const void *data, size_t n, const char *path) {
+    if (fseek(fp, offset, SEEK_SET) != 0 || fwrite(data, 1, n, fp) != n) {
+        ERROR("error writing model pack %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static std::string read_text(const std::string &path) {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        ERROR("cannot open %s: %s", path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    std::string text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        text.append(buf, n);
+    }
+    fclose(fp);
+    return text;
+}
+
+static std::vector<std::string> list_tensor_files(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        ERROR("cannot open model directory %s: %s", dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    std::vector<std::string> names;
+    struct dirent *ent;
+    const std::string suffix = ".tensor";
+    while ((ent = readdir(d)) != NULL) {
+        std::string name = ent->d_name;
+        if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            names.push_back(name);
+        }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+/* pack a model directory into out, returns the number of bytes of tensor data written */
+uint64_t write_model_pack(const char *model, const char *out, uint32_t pack_dtype) {
+    torch::ScalarType dtype = pack_dtype == MODEL_PACK_F16 ? torch::kFloat16 : torch::kFloat32;
+
+    // refuse to pack a directory the basecaller could not load
+    CRFModelConfig model_config = is_tx_model_config(model) ? load_tx_model_config(model) : load_lstm_model_config(model);
+    (void)model_config;
+
+    std::string config_text = read_text(std::string(model) + "/config.toml");
+    std::vector<std::string> names = list_tensor_files(model);
+    if (names.empty()) {
+        ERROR("no .tensor files found in %s", model);
+        exit(EXIT_FAILURE);
+    }
+
+    model_pack_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_PACK_MAGIC, sizeof(header.magic));
+    header.version = MODEL_PACK_VERSION;
+    header.n_tensors = names.size();
+    header.config_offset = align_up(sizeof(header));
+    header.config_len = config_text.size();
+    header.table_offset = align_up(header.config_offset + header.config_len + 1);
+
+    // keep only the last path component, the sample type is derived from it
+    std::string model_name = model;
+    while (model_name.size() > 1 && model_name.back() == '/') {
+        model_name.pop_back();
+    }
+    size_t slash = model_name.find_last_of('/');
+    if (slash != std::string::npos) {
+        model_name = model_name.substr(slash + 1);
+    }
+    strncpy(header.model_name, model_name.c_str(), sizeof(header.model_name) - 1);
+
+    FILE *fp = fopen(out, "wb");
+    if (!fp) {
+        ERROR("cannot open %s for writing: %s", out, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    write_at(fp, header.config_offset, config_text.c_str(), config_text.size() + 1, out);
+
+    std::vector<model_pack_entry_t> table(names.size());
+    uint64_t offset = align_up(header.table_offset + names.size() * sizeof(model_pack_entry_t));
+    uint64_t total_bytes = 0;
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (names[i].size() >= MODEL_PACK_MAX_NAME) {
+            ERROR("tensor file name %s is too long for a model pack", names[i].c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        std::vector<torch::Tensor> loaded;
+        torch::load(loaded, std::string(model) + "/" + names[i]);
+        if (loaded.size() != 1) {
+            ERROR("%s holds %zu tensors, expected one", names[i].c_str(), loaded.size());
+            exit(EXIT_FAILURE);
+        }
+        torch::Tensor t = loaded[0].to(torch::kCPU).to(dtype).contiguous();
+        if (t.dim() > MODEL_PACK_MAX_DIMS) {
+            ERROR("tensor %s has %ld dimensions, at most %d are supported", names[i].c_str(), (long)t.dim(), MODEL_PACK_MAX_DIMS);
+            exit(EXIT_FAILURE);
+        }
+
+        model_pack_entry_t &entry = table[i];
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.name, names[i].c_str(), MODEL_PACK_MAX_NAME - 1);
+        entry.dtype = pack_dtype;
+        entry.ndim = t.dim();
+        for (int64_t d = 0; d < t.dim(); ++d) {
+            entry.shape[d] = t.size(d);
+        }
+        entry.offset = offset;
+        entry.nbytes = t.numel() * t.element_size();
+
+        write_at(fp, entry.offset, t.data_ptr(), entry.nbytes, out);
+        offset = align_up(offset + entry.nbytes);
+        total_bytes += entry.nbytes;
+    }
+
+    write_at(fp, header.table_offset, table.data(), table.size() * sizeof(model_pack_entry_t), out);
+    write_at(fp, 0, &header, sizeof(header), out);
+
+    if (fclose(fp) != 0) {
+        ERROR("error writing model pack %s: %s", out, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    return total_bytes;
+}
+
+/* FNV-1a, only used to tell model directories apart in the shared pack name */
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t n) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < n; ++i) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t hash_file_stat(uint64_t h, const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        ERROR("cannot stat %s: %s", path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    h = hash_bytes(h, path.c_str(), path.size());
+    h = hash_bytes(h, &st.st_size, sizeof(st.st_size));
+    h = hash_bytes(h, &st.st_mtime, sizeof(st.st_mtime));
+    return h;
+}
+
+char *shared_model_pack(const char *model) {
+    char *abs_model = realpath(model, NULL);
+    if (abs_model == NULL) {
+        ERROR("cannot resolve model path %s: %s", model, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // a model that changes on disk gets a new pack instead of reusing a stale one
+    std::string dir = abs_model;
+    uint64_t h = 14695981039346656037ULL;
+    h = hash_file_stat(h, dir + "/config.toml");
+    std::vector<std::string> names = list_tensor_files(abs_model);
+    for (size_t i = 0; i < names.size(); ++i) {
+        h = hash_file_stat(h, dir + "/" + names[i]);
+    }
+
+    std::string model_name = dir.substr(dir.find_last_of('/') + 1);
+    const char *shm_dir = getenv("SLORADO_SHM_DIR");
+    if (shm_dir == NULL) {
+        shm_dir = "/dev/shm";
+    }
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)h);
+    std::string path = std::string(shm_dir) + "/slorado-" + model_name + "-" + hash + "-f32.pack";
+
+    if (!is_model_pack(path.c_str())) {
+        // processes starting together may all get here, each writes its own file and the renames are atomic
+        std::string tmp = path + ".tmp." + std::to_string((long)getpid());
+        double realtime0 = realtime();
+        write_model_pack(abs_model, tmp.c_str(), MODEL_PACK_F32);
+        if (rename(tmp.c_str(), path.c_str()) != 0) {
+            ERROR("cannot rename %s to %s: %s", tmp.c_str(), path.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        INFO("packed %s into %s for shared weights in %.3f sec", model, path.c_str(), realtime() - realtime0);
+    } else {
+        LOG_DEBUG("using shared weights in %s", path.c_str());
+    }
+
+    free(abs_model);
+    char *ret = strdup(path.c_str());
+    MALLOC_CHK(ret);
+    return ret;
+}
+
+int model_pack_main(int argc, char* argv[]) {
+    const char* optstring = "d:h";
+
+    int longindex = 0;
+    int32_t c = -1;
+
+    FILE *fp_help = stderr;
+    uint32_t pack_dtype = MODEL_PACK_F32;
+
+    while ((c = getopt_long(argc, argv, optstring, long_options, &longindex)) >= 0) {
+        if (c == 'd') {
+            if (strcmp(optarg, "float32") == 0) {
+                pack_dtype = MODEL_PACK_F32;
+            } else if (strcmp(optarg, "float16") == 0) {
+                pack_dtype = MODEL_PACK_F16;
+            } else {
+                ERROR("Unknown tensor type %s, use float32 or float16", optarg);
+                exit(EXIT_FAILURE);
+            }
+        } else if (c == 'h') {
+            fp_help = stdout;
+        }
+    }
+
+    if (argc - optind != 2 || fp_help == stdout) {
+        print_help_msg(fp_help);
+        if (fp_help == stdout) {
+            exit(EXIT_SUCCESS);
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    char *model = argv[optind++];
+    char *out = argv[optind];
+
+    if (is_model_pack(model)) {
+        ERROR("%s is already a model pack", model);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t total_bytes = write_model_pack(model, out, pack_dtype);
+    fprintf(stderr, "[%s] packed %.1f MB of weights from %s into %s\n", __func__, total_bytes / (1000.0 * 1000.0), model, out);
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+/* @file myers.h
+**
+** Myers' bit-parallel approximate matching of a short pattern (up to 64 bases) against a stretch of read
+** each text base updates one 64-bit column of the edit distance matrix, so a band of 64 cells costs a handful of
+** word operations, used by barcode classification and adapter trimming
+** @@
+******************************************************************************/
+
+#ifndef MYERS_H
+#define MYERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MYERS_MAX_PATTERN 64   // a pattern has to fit in one machine word
+#define MYERS_BASE_OTHER 4     // N and anything unexpected, matches only N in a pattern
+
+typedef struct {
+    uint64_t peq[5];    // bit i is set where pattern position i matches the base
+    int len;
+} myers_pattern_t;
+
+static inline uint8_t myers_base_code(char c) {
+    switch (c) {
+        case 'A': case 'a': return 0;
+        case 'C': case 'c': return 1;
+        case 'G': case 'g': return 2;
+        case 'T': case 't': case 'U': case 'u': return 3;
+    }
+    return MYERS_BASE_OTHER;
+}
+
+static inline char myers_complement(char c) {
+    switch (c) {
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'T': return 'A';
+    }
+    return 'N';
+}
+
+/* len must be between 1 and MYERS_MAX_PATTERN, an N in the pattern matches any base */
+static inline myers_pattern_t myers_make_pattern(const char *p, int len) {
+    myers_pattern_t pat;
+    memset(&pat, 0, sizeof(pat));
+    pat.len = len;
+    for (int i = 0; i < len; ++i) {
+        uint8_t code = myers_base_code(p[i]);
+        if (code == MYERS_BASE_OTHER) {
+            for (int b = 0; b < 5; ++b) {
+                pat.peq[b] |= 1ULL << i;
+            }
+        } else {
+            pat.peq[code] |= 1ULL << i;
+        }
+    }
+    return pat;
+}
+
+/* smallest edit distance of the pattern against any substring of text (bases coded by myers_base_code), Myers (1999)
+   when end is not NULL it gets the position just past the first substring reaching that distance */
+static inline int myers_search(const myers_pattern_t *pat, const uint8_t *text, size_t n, size_t *end) {
+    const uint64_t hb = 1ULL << (pat->len - 1);
+    uint64_t pv = ~0ULL;
+    uint64_t mv = 0;
+    int score = pat->len;
+    int best = score;
+    size_t best_end = 0;
+    for (size_t j = 0; j < n; ++j) {
+        const uint64_t eq = pat->peq[text[j]];
+        const uint64_t xv = eq | mv;
+        const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        if (ph & hb) {
+            score++;
+        } else if (mh & hb) {
+            score--;
+        }
+        // no carry into the first row, the match may start anywhere in the text
+        ph <<= 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+        if (score < best) {
+            best = score;
+            best_end = j + 1;
+        }
+    }
+    if (end) {
+        *end = best_end;
+    }
+    return best;
+}
+
+#endif
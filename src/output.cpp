@@ -0,0 +1,486 @@
+/* @file output.cpp
+**
+** where basecalled reads go: the main output or its shards, the fail output and the summary
+** @@
+******************************************************************************/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "output.h"
+#include "zwriter.h"
+#include "error.h"
+
+static bool has_suffix(const std::string &s, const char *suffix) {
+    size_t m = strlen(suffix);
+    return s.size() >= m && s.compare(s.size() - m, m, suffix) == 0;
+}
+
+const char *output_format_name(int format) {
+    switch (format) {
+        case WRITER_SAM: return "sam";
+        case WRITER_BAM: return "bam";
+    }
+    return "fastq";
+}
+
+static const char *codec_suffix(int codec) {
+    switch (codec) {
+        case ZW_BGZF: return ".gz";
+        case ZW_ZSTD: return ".zst";
+    }
+    return "";
+}
+
+static void check_codec(int format, int codec, int level, const std::string &path) {
+    if (codec != ZW_NONE && !zw_supported(codec)) {
+        ERROR("Cannot write %s, slorado was built without zstd (rebuild with make zstd=1)", path.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (format == WRITER_BAM && codec == ZW_ZSTD) {
+        ERROR("%s", "BAM is always BGZF compressed, it cannot be written as .zst");
+        exit(EXIT_FAILURE);
+    }
+    int max_level = codec == ZW_ZSTD ? 19 : 9;
+    if (level > max_level) {
+        ERROR("Compression level should be at most %d for this output. You entered %d", max_level, level);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* dir/reads.fastq.gz with tag fail is dir/reads.fail.fastq.gz */
+static std::string insert_tag(const std::string &path, const std::string &tag) {
+    char buf[4096];
+    zw_strip_suffix(path.c_str(), buf, sizeof(buf));
+    std::string name = buf;
+    size_t dot = name.find_last_of('.');
+    size_t slash = name.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        dot = name.size();
+    }
+    return name.substr(0, dot) + "." + tag + name.substr(dot) + path.substr(name.size());
+}
+
+static bool rotating(const output_t *out) {
+    return out->rotate_reads > 0 || out->rotate_bytes > 0;
+}
+
+static void open_segment(output_t *out, out_file_t *f) {
+    const char *path = f->path;
+    std::string part;
+    if (rotating(out)) {
+        char seg[16];
+        snprintf(seg, sizeof(seg), "%05d", f->segment);
+        std::string seg_path = insert_tag(f->path, seg);
+        f->seg_path = strdup(seg_path.c_str());
+        MALLOC_CHK(f->seg_path);
+        part = seg_path + OUTPUT_PART_SUFFIX;
+        path = part.c_str();
+    }
+    f->fp = fopen(path, "w");
+    if (f->fp == NULL) {
+        ERROR("Error in opening output file %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    f->seg_reads = 0;
+    f->w = init_writer(f->fp, out->format, f->codec, out->level, f->threads, f->pool, out->buf_size, out->cmdline);
+}
+
+/* the segment only gets its final name once it is complete, the rename is atomic */
+static void close_segment(out_file_t *f) {
+    free_writer(f->w);
+    if (f->fp != stdout && fclose(f->fp) != 0) {
+        ERROR("Error writing %s: %s", f->seg_path ? f->seg_path : f->path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (f->seg_path == NULL) {
+        return;
+    }
+
+    std::string part = std::string(f->seg_path) + OUTPUT_PART_SUFFIX;
+    if (f->seg_reads == 0 && f->segment > 0) { // the run ended right after a rotation
+        unlink(part.c_str());
+    } else {
+        if (rename(part.c_str(), f->seg_path) != 0) {
+            ERROR("Cannot rename %s to %s: %s", part.c_str(), f->seg_path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        std::string done = std::string(f->seg_path) + OUTPUT_DONE_SUFFIX;
+        FILE *fp = fopen(done.c_str(), "w");
+        if (fp == NULL || fclose(fp) != 0) {
+            ERROR("Cannot create %s: %s", done.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        f->done_paths = (char **)realloc(f->done_paths, (f->num_done + 1) * sizeof(char *));
+        MALLOC_CHK(f->done_paths);
+        f->done_reads = (int64_t *)realloc(f->done_reads, (f->num_done + 1) * sizeof(int64_t));
+        MALLOC_CHK(f->done_reads);
+        f->done_paths[f->num_done] = f->seg_path;
+        f->done_reads[f->num_done] = f->seg_reads;
+        f->num_done++;
+        f->seg_path = NULL;
+        return;
+    }
+    free(f->seg_path);
+    f->seg_path = NULL;
+}
+
+/* path NULL is stdout */
+static void open_file(output_t *out, out_file_t *f, const char *path, int codec, int threads) {
+    f->codec = codec;
+    f->threads = threads;
+    if (path == NULL) {
+        if ((out->format == WRITER_BAM || codec != ZW_NONE) && isatty(fileno(stdout))) {
+            ERROR("%s", "Refusing to write compressed output to a terminal, use -o or redirect stdout");
+            exit(EXIT_FAILURE);
+        }
+        f->fp = stdout;
+        f->w = init_writer(f->fp, out->format, codec, out->level, threads, NULL, out->buf_size, out->cmdline);
+    } else {
+        f->path = strdup(path);
+        MALLOC_CHK(f->path);
+        open_segment(out, f);
+    }
+}
+
+static void write_file(output_t *out, out_file_t *f, const read_out_t *read) {
+    write_read(f->w, read);
+    f->reads++;
+    f->seg_reads++;
+    if (f->seg_path &&
+        ((out->rotate_reads > 0 && f->seg_reads >= out->rotate_reads) ||
+         (out->rotate_bytes > 0 && writer_bytes(f->w) >= (uint64_t)out->rotate_bytes))) {
+        close_segment(f);
+        f->segment++;
+        open_segment(out, f);
+    }
+}
+
+output_t *init_output(const opt_t *opt, const char *cmdline) {
+    output_t *out = (output_t *)calloc(1, sizeof(output_t));
+    MALLOC_CHK(out);
+    out->level = opt->compress_level;
+    out->buf_size = opt->write_buffer;
+    out->cmdline = cmdline;
+    out->min_qscore = opt->min_qscore;
+    out->num_shards = opt->out_shards;
+    out->rotate_reads = opt->rotate_reads;
+    out->rotate_bytes = opt->rotate_bytes;
+    out->trimming = opt->trim_sequences != NULL;
+
+    const bool sharded = opt->out_shards > 1;
+    if (sharded && opt->out_path == NULL) {
+        ERROR("%s", "--out-shards needs -o DIR");
+        exit(EXIT_FAILURE);
+    }
+    if (rotating(out) && opt->out_path == NULL) {
+        ERROR("%s", "--rotate-output needs -o");
+        exit(EXIT_FAILURE);
+    }
+    if (opt->barcode_arrangement != NULL && (opt->out_path == NULL || sharded)) {
+        ERROR("%s", "demultiplexing needs -o FILE and cannot be combined with --out-shards");
+        exit(EXIT_FAILURE);
+    }
+
+    // reads.fastq.gz and reads.fastq.zst are compressed, the format comes from what is left of the name
+    std::string name;
+    out->codec = opt->out_codec;
+    if (opt->out_path != NULL && !sharded) {
+        char buf[4096];
+        zw_strip_suffix(opt->out_path, buf, sizeof(buf));
+        name = buf;
+        if (out->codec < 0) {
+            out->codec = zw_codec_from_path(opt->out_path);
+        }
+    }
+    if (out->codec < 0) {
+        out->codec = ZW_NONE;
+    }
+
+    // an explicit --output-format wins over the -o suffix, --emit-fastq=no is the older way to ask for SAM
+    out->format = opt->out_format;
+    if (out->format < 0) {
+        if (has_suffix(name, ".bam")) {
+            out->format = WRITER_BAM;
+        } else if (has_suffix(name, ".sam")) {
+            out->format = WRITER_SAM;
+        } else {
+            out->format = (opt->flag & SLORADO_EFQ) ? WRITER_FASTQ : WRITER_SAM;
+        }
+    }
+    check_codec(out->format, out->codec, out->level, opt->out_path ? opt->out_path : "stdout");
+
+    // --compress-threads is shared by the shards
+    int threads = opt->compress_threads / out->num_shards;
+    threads = threads > 0 ? threads : 1;
+
+    out->shards = (out_file_t *)calloc(out->num_shards, sizeof(out_file_t));
+    MALLOC_CHK(out->shards);
+    const std::string ext = std::string(".") + output_format_name(out->format) + (out->format == WRITER_BAM ? "" : codec_suffix(out->codec));
+    if (sharded) {
+        out->dir = strdup(opt->out_path);
+        MALLOC_CHK(out->dir);
+        if (mkdir(out->dir, 0755) != 0 && errno != EEXIST) {
+            ERROR("Cannot create output directory %s: %s", out->dir, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        for (int32_t k = 0; k < out->num_shards; ++k) {
+            char shard[32];
+            snprintf(shard, sizeof(shard), "/reads_%04d", k);
+            std::string path = std::string(out->dir) + shard + ext;
+            open_file(out, &out->shards[k], path.c_str(), out->codec, threads);
+        }
+    } else if (opt->barcode_arrangement != NULL) {
+        out->demux_path = strdup(opt->out_path);
+        MALLOC_CHK(out->demux_path);
+        // barcode files are opened as reads arrive, up to one per barcode, so they share one pool of threads
+        // rather than each taking all of them
+        const int demux_codec = out->format == WRITER_BAM ? ZW_BGZF : out->codec;
+        if (demux_codec != ZW_NONE) {
+            out->demux_pool = zw_pool_create(demux_codec, out->level, opt->compress_threads);
+        }
+    } else {
+        open_file(out, &out->shards[0], opt->out_path, out->codec, threads);
+    }
+
+    // failing reads land next to the passing ones, reads.fastq.gz -> reads.fail.fastq.gz
+    std::string fail_path;
+    int fail_codec = out->codec;
+    if (opt->min_qscore > 0) {
+        if (opt->fail_path != NULL) {
+            fail_path = opt->fail_path;
+            fail_codec = zw_codec_from_path(opt->fail_path);
+        } else if (sharded) {
+            fail_path = std::string(out->dir) + "/fail" + ext;
+        } else if (opt->out_path != NULL) {
+            fail_path = insert_tag(opt->out_path, "fail");
+        }
+        if (!fail_path.empty()) {
+            check_codec(out->format, fail_codec, out->level, fail_path);
+            open_file(out, &out->fail, fail_path.c_str(), fail_codec, threads);
+        } else {
+            WARNING("%s", "Reads below --min-qscore are dropped, give --fail-output to keep them");
+        }
+    } else if (opt->fail_path != NULL) {
+        WARNING("%s", "--fail-output has no effect without --min-qscore");
+    }
+
+    if (opt->summary_path != NULL) {
+        out->summary = fopen(opt->summary_path, "w");
+        if (out->summary == NULL) {
+            ERROR("Error in opening summary file %s: %s", opt->summary_path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        fprintf(out->summary, "read_id\tpasses_filtering\tnum_samples\ttrimmed_samples\tduration\tsequence_length_template\tmean_qscore_template%s%s\n",
+                opt->barcode_arrangement ? "\tbarcode" : "", out->trimming ? "\ttrimmed_bases_front\ttrimmed_bases_rear" : "");
+    }
+
+    return out;
+}
+
+/* argument wrapper for a shard writer thread */
+typedef struct {
+    output_t *out;
+    int32_t shard;
+    const read_out_t *reads;
+    int32_t n;
+    int64_t first_index;
+} shard_arg_t;
+
+static inline bool passes(const output_t *out, const read_out_t *read) {
+    return read->mean_qscore >= out->min_qscore;
+}
+
+static void *pthread_write_shard(void *voidargs) {
+    shard_arg_t *args = (shard_arg_t *)voidargs;
+    output_t *out = args->out;
+    out_file_t *f = &out->shards[args->shard];
+
+    // the first read of the batch that belongs to this shard, then every num_shards-th
+    int32_t i = (args->shard - args->first_index % out->num_shards + out->num_shards) % out->num_shards;
+    for (; i < args->n; i += out->num_shards) {
+        const read_out_t *read = &args->reads[i];
+        if (read->num_samples > 0 && passes(out, read)) {
+            write_file(out, f, read);
+        }
+    }
+    pthread_exit(0);
+}
+
+/* reads.fastq.gz with barcode BC01 goes to reads.BC01.fastq.gz */
+static out_file_t *barcode_file(output_t *out, const read_out_t *read) {
+    int32_t i = read->barcode < 0 ? 0 : read->barcode + 1;
+    if (i >= out->num_barcodes) {
+        out->barcodes = (out_file_t *)realloc(out->barcodes, (i + 1) * sizeof(out_file_t));
+        MALLOC_CHK(out->barcodes);
+        memset(out->barcodes + out->num_barcodes, 0, (i + 1 - out->num_barcodes) * sizeof(out_file_t));
+        out->num_barcodes = i + 1;
+    }
+    out_file_t *f = &out->barcodes[i];
+    if (f->w == NULL) {
+        std::string path = insert_tag(out->demux_path, read->barcode_name);
+        f->pool = out->demux_pool;
+        open_file(out, f, path.c_str(), out->codec, 0);
+    }
+    return f;
+}
+
+void write_output(output_t *out, const read_out_t *reads, int32_t n, int64_t first_index) {
+    std::vector<pthread_t> tids;
+    std::vector<shard_arg_t> args(out->num_shards);
+
+    if (out->demux_path) {
+        for (int32_t i = 0; i < n; ++i) {
+            if (reads[i].num_samples > 0 && passes(out, &reads[i])) {
+                write_file(out, barcode_file(out, &reads[i]), &reads[i]);
+            }
+        }
+    } else if (out->num_shards == 1) {
+        for (int32_t i = 0; i < n; ++i) {
+            if (reads[i].num_samples > 0 && passes(out, &reads[i])) {
+                write_file(out, &out->shards[0], &reads[i]);
+            }
+        }
+    } else {
+        // each shard formats and compresses its own reads, this thread keeps the fail output and the summary
+        tids.resize(out->num_shards);
+        for (int32_t k = 0; k < out->num_shards; ++k) {
+            args[k] = {out, k, reads, n, first_index};
+            int ret = pthread_create(&tids[k], NULL, pthread_write_shard, (void *)&args[k]);
+            NEG_CHK(ret);
+        }
+    }
+
+    for (int32_t i = 0; i < n; ++i) {
+        const read_out_t *read = &reads[i];
+        if (read->num_samples == 0) {
+            continue;
+        }
+        bool pass = passes(out, read);
+        if (!pass) {
+            out->fail_reads++;
+            if (out->fail.fp) {
+                write_file(out, &out->fail, read);
+            }
+        }
+        if (out->summary) {
+            fprintf(out->summary, "%s\t%s\t%" PRIu64 "\t%" PRId64 "\t%.3f\t%zu\t%.2f",
+                    read->read_id, pass ? "TRUE" : "FALSE", read->num_samples, read->trimmed_samples,
+                    read->duration, read->len, read->mean_qscore);
+            if (out->demux_path) {
+                fprintf(out->summary, "\t%s", read->barcode_name);
+            }
+            if (out->trimming) {
+                fprintf(out->summary, "\t%d\t%d", read->trimmed_front, read->trimmed_rear);
+            }
+            fputc('\n', out->summary);
+        }
+    }
+
+    for (size_t k = 0; k < tids.size(); ++k) {
+        int ret = pthread_join(tids[k], NULL);
+        NEG_CHK(ret);
+    }
+
+    // a batch is out once output_db returns, even when it did not fill a buffer
+    for (int32_t k = 0; k < out->num_shards; ++k) {
+        if (out->shards[k].w) {
+            flush_writer(out->shards[k].w);
+        }
+    }
+    for (int32_t i = 0; i < out->num_barcodes; ++i) {
+        if (out->barcodes[i].w) {
+            flush_writer(out->barcodes[i].w);
+        }
+    }
+    if (out->fail.fp) {
+        flush_writer(out->fail.w);
+    }
+}
+
+static const char *base_name(const char *path) {
+    const char *base = strrchr(path, '/');
+    return base ? base + 1 : path;
+}
+
+/* a row per file that exists, with rotation a row per completed segment */
+static void write_manifest(output_t *out) {
+    std::string path = std::string(out->dir) + "/" + OUTPUT_MANIFEST;
+    FILE *fp = fopen(path.c_str(), "w");
+    if (fp == NULL) {
+        ERROR("Error in opening %s: %s", path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "shard\tpath\tformat\treads\tsegment\n");
+    for (int32_t k = 0; k < out->num_shards; ++k) {
+        const out_file_t *f = &out->shards[k];
+        if (!rotating(out)) {
+            fprintf(fp, "%d\t%s\t%s\t%" PRId64 "\t0\n", k, base_name(f->path), output_format_name(out->format), f->reads);
+            continue;
+        }
+        for (int32_t s = 0; s < f->num_done; ++s) {
+            fprintf(fp, "%d\t%s\t%s\t%" PRId64 "\t%d\n", k, base_name(f->done_paths[s]), output_format_name(out->format), f->done_reads[s], s);
+        }
+    }
+    if (fclose(fp) != 0) {
+        ERROR("Error writing %s: %s", path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void free_done(out_file_t *f) {
+    for (int32_t s = 0; s < f->num_done; ++s) {
+        free(f->done_paths[s]);
+    }
+    free(f->done_paths);
+    free(f->done_reads);
+}
+
+void free_output(output_t *out) {
+    for (int32_t k = 0; k < out->num_shards; ++k) {
+        if (out->shards[k].w) {
+            close_segment(&out->shards[k]);
+        }
+    }
+    for (int32_t i = 0; i < out->num_barcodes; ++i) {
+        if (out->barcodes[i].w) {
+            close_segment(&out->barcodes[i]);
+        }
+        free(out->barcodes[i].path);
+        free_done(&out->barcodes[i]);
+    }
+    if (out->demux_pool) {
+        zw_pool_free(out->demux_pool);
+    }
+    if (out->fail.fp) {
+        close_segment(&out->fail);
+    }
+    if (out->summary && fclose(out->summary) != 0) {
+        ERROR("Error writing the summary: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    // written last, so a manifest means every shard it lists is complete
+    if (out->dir) {
+        write_manifest(out);
+    }
+    for (int32_t k = 0; k < out->num_shards; ++k) {
+        free(out->shards[k].path);
+        free_done(&out->shards[k]);
+    }
+    free(out->fail.path);
+    free_done(&out->fail);
+    free(out->barcodes);
+    free(out->demux_path);
+    free(out->dir);
+    free(out->shards);
+    free(out);
+}
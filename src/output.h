@@ -0,0 +1,80 @@
+/* @file output.h
+**
+** where basecalled reads go: the main output or its shards, the fail output and the summary
+** @@
+******************************************************************************/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "slorado.h"
+#include "writer.h"
+
+#define OUTPUT_MANIFEST "manifest.tsv" // lists the shards, inside the -o directory
+
+#define OUTPUT_PART_SUFFIX ".part" // a segment being written
+#define OUTPUT_DONE_SUFFIX ".done" // marker created next to a segment once it is complete
+
+/* one output file and its writer, with rotation a sequence of segments named after path */
+typedef struct {
+    char *path;         // NULL for stdout
+    FILE *fp;
+    writer_t *w;
+    int64_t reads;
+
+    int codec;
+    int threads;
+    zpool_t *pool;      // compresses on this shared pool instead of threads of its own, NULL for none
+    char *seg_path;     // final name of the segment being written, NULL without rotation
+    int32_t segment;
+    int64_t seg_reads;
+
+    // segments completed so far, for the shard manifest
+    char **done_paths;
+    int64_t *done_reads;
+    int32_t num_done;
+} out_file_t;
+
+struct output {
+    int format;         // WRITER_ format of every file
+    int codec;          // ZW_ codec of the main output and its shards
+    int level;
+    size_t buf_size;    // bytes each writer formats before writing them out
+    const char *cmdline;
+    float min_qscore;
+
+    char *dir;          // shard directory, NULL when the output is a single file
+    out_file_t *shards; // the main output is shard 0 when not sharded
+    int32_t num_shards;
+    out_file_t fail;    // fp is NULL when failing reads are dropped
+    FILE *summary;      // NULL for none
+    int64_t rotate_reads; // start a new segment after this many reads, 0 for never
+    int64_t rotate_bytes; // or after this many bytes before compression, 0 for never
+
+    // demultiplexing, a file per barcode opened on its first read, unclassified reads at index 0
+    char *demux_path;     // -o, the barcode goes before its format suffix, NULL when not demultiplexing
+    out_file_t *barcodes;
+    int32_t num_barcodes;
+    zpool_t *demux_pool;  // --compress-threads shared by every barcode file, NULL when they are not compressed
+
+    int trimming;         // reads were trimmed, the summary reports by how much
+
+    int64_t fail_reads;
+};
+
+/* resolve the format and compression from the options and open every output */
+output_t *init_output(const opt_t *opt, const char *cmdline);
+
+/* route a batch of reads, read i of the batch is read first_index + i of the run and goes to shard
+   (first_index + i) % num_shards, so the split does not depend on timing. reads without signal are skipped */
+void write_output(output_t *out, const read_out_t *reads, int32_t n, int64_t first_index);
+
+/* flush and close every file, write the shard manifest */
+void free_output(output_t *out);
+
+const char *output_format_name(int format);
+
+#endif
@@ -0,0 +1,86 @@
+/* @file profile.cpp
+**
+** basecaller parameter profiles written by slorado tune and loaded with --profile
+** @@
+******************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <toml.h>
+
+#include "profile.h"
+#include "error.h"
+
+// positive integer entry of the profile, or def when it is absent
+static int64_t profile_int(toml_table_t *table, const char *key, int64_t def) {
+    toml_datum_t datum = toml_int_in(table, key);
+    if (!datum.ok) {
+        return def;
+    }
+    if (datum.u.i < 1) {
+        ERROR("profile value %s should be larger than 0. Found %ld", key, (long)datum.u.i);
+        exit(EXIT_FAILURE);
+    }
+    return datum.u.i;
+}
+
+void load_profile(const char *path, opt_t *opt) {
+    char errbuf[200];
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        ERROR("cannot open profile - %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    toml_table_t *profile_toml = toml_parse_file(fp, errbuf, sizeof(errbuf));
+    fclose(fp);
+    if (!profile_toml) {
+        ERROR("cannot parse profile - %s: %s", path, errbuf);
+        exit(EXIT_FAILURE);
+    }
+
+    toml_table_t *basecaller = toml_table_in(profile_toml, "basecaller");
+    if (!basecaller) {
+        ERROR("profile %s has no [basecaller] table", path);
+        exit(EXIT_FAILURE);
+    }
+
+    toml_datum_t device = toml_string_in(basecaller, "device");
+    if (device.ok) {
+        opt->device = device.u.s; // lives as long as the options
+    }
+
+    opt->gpu_batch_size = profile_int(basecaller, "gpu_batch_size", opt->gpu_batch_size);
+    opt->chunk_size = profile_int(basecaller, "chunk_size", opt->chunk_size);
+    opt->num_thread = profile_int(basecaller, "threads", opt->num_thread);
+    opt->num_runners = profile_int(basecaller, "runners", opt->num_runners);
+
+    toml_free(profile_toml);
+}
+
+void write_profile(const char *path, const opt_t *opt, const char *model, double samples_per_sec) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        ERROR("cannot open profile for writing - %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(fp, "# written by slorado tune %s\n", SLORADO_VERSION);
+    fprintf(fp, "# model: %s\n", model);
+    fprintf(fp, "# throughput: %.0f samples/s\n\n", samples_per_sec);
+    fprintf(fp, "[basecaller]\n");
+    fprintf(fp, "device = \"%s\"\n", opt->device);
+    fprintf(fp, "gpu_batch_size = %d\n", opt->gpu_batch_size);
+    fprintf(fp, "chunk_size = %zu\n", opt->chunk_size);
+    fprintf(fp, "threads = %d\n", opt->num_thread);
+    fprintf(fp, "runners = %d\n", opt->num_runners);
+
+    if (fclose(fp) != 0) {
+        ERROR("error writing profile %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,18 @@
+/* @file profile.h
+**
+** basecaller parameter profiles written by slorado tune and loaded with --profile
+** @@
+******************************************************************************/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "slorado.h"
+
+/* overwrite the options present in the profile, options missing from it are left untouched */
+void load_profile(const char *path, opt_t *opt);
+
+/* write the parameters of opt that tune searches over, with the throughput they achieved */
+void write_profile(const char *path, const opt_t *opt, const char *model, double samples_per_sec);
+
+#endif
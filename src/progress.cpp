@@ -0,0 +1,176 @@
+/* @file progress.cpp
+**
+** background reporter of basecalling progress, rolling throughput and ETA, on stderr and in a status file
+** @@
+******************************************************************************/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <string>
+
+#include "progress.h"
+#include "misc.h"
+#include "error.h"
+
+/* 1234567 -> 1.2M */
+static void format_count(char *buf, size_t size, double x) {
+    if (x >= 1e9) {
+        snprintf(buf, size, "%.1fG", x / 1e9);
+    } else if (x >= 1e6) {
+        snprintf(buf, size, "%.1fM", x / 1e6);
+    } else if (x >= 1e3) {
+        snprintf(buf, size, "%.1fK", x / 1e3);
+    } else {
+        snprintf(buf, size, "%.0f", x);
+    }
+}
+
+/* the status file is replaced in one rename, a reader never sees it half written */
+static void write_status(const progress_t *p, const char *state, double elapsed, int64_t bytes, int64_t reads,
+                         int64_t samples, int64_t bases, int64_t chunks, double samples_per_sec, double bases_per_sec,
+                         double chunks_per_sec, double eta) {
+    std::string tmp = std::string(p->status_path) + PROGRESS_TMP_SUFFIX;
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (fp == NULL) {
+        WARNING("Cannot write status file %s: %s", tmp.c_str(), strerror(errno));
+        return;
+    }
+    fprintf(fp, "{\"state\": \"%s\", \"time\": %ld, \"elapsed\": %.1f, \"reads\": %" PRId64 ", \"samples\": %" PRId64 ", "
+            "\"bases\": %" PRId64 ", \"chunks\": %" PRId64 ", \"bytes\": %" PRId64 ", \"input_bytes\": %" PRId64 ", "
+            "\"samples_per_sec\": %.1f, \"bases_per_sec\": %.1f, \"chunks_per_sec\": %.1f, \"eta_sec\": ",
+            state, (long)time(NULL), elapsed, reads, samples, bases, chunks, bytes, p->input_bytes,
+            samples_per_sec, bases_per_sec, chunks_per_sec);
+    if (eta >= 0) {
+        fprintf(fp, "%.0f}\n", eta);
+    } else {
+        fprintf(fp, "null}\n");
+    }
+    if (fclose(fp) != 0 || rename(tmp.c_str(), p->status_path) != 0) {
+        WARNING("Cannot write status file %s: %s", p->status_path, strerror(errno));
+    }
+}
+
+static void report(progress_t *p, const char *state) {
+    const double now = realtime();
+    const double elapsed = now - p->realtime0;
+    const int64_t bytes = p->bytes.load(std::memory_order_relaxed);
+    const int64_t reads = p->reads.load(std::memory_order_relaxed);
+    const int64_t samples = p->samples.load(std::memory_order_relaxed);
+    const int64_t bases = p->bases.load(std::memory_order_relaxed);
+    const int64_t chunks = p->chunks.load(std::memory_order_relaxed);
+
+    // rolling rates over the last interval, so a stall shows up straight away rather than diluted by the whole run
+    const double dt = now - p->last_time;
+    const double samples_per_sec = dt > 0 ? (samples - p->last_samples) / dt : 0;
+    const double bases_per_sec = dt > 0 ? (bases - p->last_bases) / dt : 0;
+    const double chunks_per_sec = dt > 0 ? (chunks - p->last_chunks) / dt : 0;
+    p->last_time = now;
+    p->last_samples = samples;
+    p->last_bases = bases;
+    p->last_chunks = chunks;
+
+    // the ETA assumes the rest of the input goes at the average pace so far
+    double fraction = p->input_bytes > 0 ? (double)bytes / p->input_bytes : -1;
+    fraction = fraction > 1 ? 1 : fraction;
+    double eta = fraction > 0 ? elapsed * (1 - fraction) / fraction : -1;
+    if (strcmp(state, "done") == 0) {
+        eta = 0;
+    }
+
+    if (p->print) {
+        char s[32], sr[32], b[32], br[32];
+        format_count(s, sizeof(s), samples);
+        format_count(sr, sizeof(sr), samples_per_sec);
+        format_count(b, sizeof(b), bases);
+        format_count(br, sizeof(br), bases_per_sec);
+        fprintf(stderr, "[progress::%.3f*%.2f] %" PRId64 " reads, %s samples (%s/s), %s bases (%s/s), %" PRId64 " chunks (%.1f/s)",
+                elapsed, cputime() / elapsed, reads, s, sr, b, br, chunks, chunks_per_sec);
+        if (fraction >= 0) {
+            fprintf(stderr, ", %.1f%% of input", 100 * fraction);
+        }
+        if (eta >= 0) {
+            fprintf(stderr, ", ETA %.1f min", eta / 60);
+        }
+        fprintf(stderr, "\n");
+    }
+    if (p->status_path) {
+        write_status(p, state, elapsed, bytes, reads, samples, bases, chunks, samples_per_sec, bases_per_sec,
+                     chunks_per_sec, eta);
+    }
+}
+
+static void *pthread_progress(void *voidargs) {
+    progress_t *p = (progress_t *)voidargs;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stop) {
+        double wake = realtime() + p->interval;
+        struct timespec ts;
+        ts.tv_sec = (time_t)wake;
+        ts.tv_nsec = (long)((wake - floor(wake)) * 1e9);
+        // wait out the interval, or until stop_progress signals
+        while (!p->stop && pthread_cond_timedwait(&p->cond, &p->lock, &ts) != ETIMEDOUT) {
+        }
+        if (!p->stop) {
+            report(p, "running");
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    pthread_exit(0);
+}
+
+progress_t *start_progress(const char *input, double interval, int print, const char *status_path, double realtime0) {
+    progress_t *p = new progress_t();
+    p->interval = interval > 0 ? interval : PROGRESS_INTERVAL;
+    p->print = print;
+    p->realtime0 = realtime0;
+    p->last_time = realtime();
+    if (status_path) {
+        p->status_path = strdup(status_path);
+        MALLOC_CHK(p->status_path);
+    }
+
+    struct stat st;
+    if (stat(input, &st) == 0 && S_ISREG(st.st_mode)) {
+        p->input_bytes = st.st_size;
+    }
+
+    // gettimeofday and the default condition clock are both the realtime clock
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    int ret = pthread_create(&p->tid, NULL, pthread_progress, (void *)p);
+    NEG_CHK(ret);
+
+    return p;
+}
+
+void stop_progress(progress_t *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    int ret = pthread_join(p->tid, NULL);
+    NEG_CHK(ret);
+
+    if (p->status_path) {
+        p->print = 0;
+        p->last_time = p->realtime0;
+        p->last_samples = 0;
+        p->last_bases = 0;
+        p->last_chunks = 0;
+        report(p, "done");
+    }
+
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+    free(p->status_path);
+    delete p;
+}
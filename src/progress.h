@@ -0,0 +1,57 @@
+/* @file progress.h
+**
+** background reporter of basecalling progress, rolling throughput and ETA, on stderr and in a status file
+** @@
+******************************************************************************/
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#define PROGRESS_INTERVAL 10.0      // seconds between reports when only a status file is asked for
+#define PROGRESS_TMP_SUFFIX ".tmp"  // the status file is written here first and renamed over the old one
+
+/* the counters are added to by the stages as they go, relaxed, and read by the reporter thread */
+struct progress {
+    std::atomic<int64_t> bytes;     // input bytes of the reads written out
+    std::atomic<int64_t> reads;     // reads basecalled
+    std::atomic<int64_t> samples;   // signal samples handed to the runners
+    std::atomic<int64_t> bases;
+    std::atomic<int64_t> chunks;    // chunks through the model
+
+    int64_t input_bytes;            // size of the input file, 0 when unknown
+    double interval;
+    int print;                      // report on stderr, not only in the status file
+    char *status_path;              // NULL for none
+    double realtime0;
+
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+
+    // the previous report, rolling rates are over the interval since
+    double last_time;
+    int64_t last_samples;
+    int64_t last_bases;
+    int64_t last_chunks;
+};
+
+typedef struct progress progress_t;
+
+/* start the reporter thread, every interval seconds it prints a line to stderr when print is set and rewrites
+   status_path when it is not NULL. input is the data file, its size gives the fraction done and the ETA */
+progress_t *start_progress(const char *input, double interval, int print, const char *status_path, double realtime0);
+
+/* stop the reporter, the status file is left with the final counters and state done */
+void stop_progress(progress_t *p);
+
+static inline void progress_add(std::atomic<int64_t> &counter, int64_t n) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+#endif
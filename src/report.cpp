@@ -0,0 +1,135 @@
+/* @file report.cpp
+**
+** machine-readable JSON report of a basecalling run, written with --report
+** @@
+******************************************************************************/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "report.h"
+#include "output.h"
+#include "zwriter.h"
+#include "misc.h"
+#include "error.h"
+
+static void json_string(FILE *fp, const char *s) {
+    if (s == NULL) {
+        fputs("null", fp);
+        return;
+    }
+    fputc('"', fp);
+    for (; *s; ++s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/* a rate, 0 when nothing was timed */
+static double per_sec(double n, double sec) {
+    return sec > 0 ? n / sec : 0;
+}
+
+static void write_model_stats(FILE *fp, const core_t *core, const runner_stat_t *ts) {
+    if (core->model_config->tx != NULL) {
+        const tx_stats_t *s = (const tx_stats_t *)ts->model_stats;
+        fprintf(fp, ", \"time_conv_stack\": %.3f, \"time_tx_encoder\": %.3f, \"time_self_attn\": %.3f, \"time_mm\": %.3f, "
+                "\"time_rotary_emb\": %.3f, \"time_sdp_attn\": %.3f, \"time_out_proj\": %.3f, \"time_norm1\": %.3f, "
+                "\"time_ff\": %.3f, \"time_norm2\": %.3f, \"time_tx_decoder\": %.3f, \"time_crf\": %.3f",
+                s->time_conv_stack, s->time_tx_encoder, s->time_self_attn, s->time_mm, s->time_rotary_emb,
+                s->time_sdp_attn, s->time_out_proj, s->time_norm1, s->time_ff, s->time_norm2, s->time_tx_decoder,
+                s->time_crf);
+    }
+}
+
+void write_report(const char *path, const core_t *core, const output_t *out, const char *model, const char *data,
+                  const char *cmdline, double realtime0) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        ERROR("cannot open report for writing - %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    const opt_t *opt = &core->opt;
+    const double wall = realtime() - realtime0;
+    const std::vector<runner_stat_t *> &runner_stats = *core->runner_stats;
+    uint64_t chunks = 0;
+    uint64_t batches = 0;
+    for (size_t i = 0; i < runner_stats.size(); ++i) {
+        chunks += runner_stats[i]->num_chunks;
+        batches += runner_stats[i]->num_batches;
+    }
+
+    fprintf(fp, "{\n  \"version\": ");
+    json_string(fp, SLORADO_VERSION);
+    fprintf(fp, ",\n  \"command\": ");
+    json_string(fp, cmdline);
+
+    fprintf(fp, ",\n  \"config\": {\"model\": ");
+    json_string(fp, model);
+    fprintf(fp, ", \"input\": ");
+    json_string(fp, data);
+    fprintf(fp, ", \"output\": ");
+    json_string(fp, opt->out_path);
+    fprintf(fp, ", \"output_format\": \"%s\", \"compression\": \"%s\", \"out_shards\": %d, \"device\": ",
+            output_format_name(out->format), out->format == WRITER_BAM || out->codec == ZW_BGZF ? "bgzf" : out->codec == ZW_ZSTD ? "zstd" : "none",
+            out->num_shards);
+    json_string(fp, opt->device);
+    fprintf(fp, ", \"chunk_size\": %zu, \"overlap\": %d, \"batch_size\": %d, \"batch_size_bytes\": %" PRId64 ", "
+            "\"gpu_batch_size\": %d, \"threads\": %d, \"runners\": %d, \"min_qscore\": %.2f}",
+            core->chunk_size, opt->overlap, opt->batch_size, opt->batch_size_bytes, opt->gpu_batch_size,
+            opt->num_thread, opt->num_runners, opt->min_qscore);
+
+    fprintf(fp, ",\n  \"totals\": {\"reads\": %" PRId64 ", \"fail_reads\": %" PRId64 ", \"bytes\": %" PRId64 ", "
+            "\"samples\": %" PRId64 ", \"bases\": %" PRId64 ", \"chunks\": %" PRIu64 ", \"batches\": %d, \"gpu_batches\": %" PRIu64 "}",
+            core->total_reads, out->fail_reads, core->sum_bytes, core->total_samples, core->total_bases, chunks,
+            core->num_batches, batches);
+
+    fprintf(fp, ",\n  \"timings\": {\"wall\": %.3f, \"cpu\": %.3f, \"time_init_runners\": %.3f, \"time_wait_runners\": %.3f, "
+            "\"time_load_db\": %.3f, \"time_process_db\": %.3f, \"time_parse\": %.3f, \"time_preproc\": %.3f, "
+            "\"time_runners\": %.3f, \"time_sync\": %.3f, \"time_postproc\": %.3f, \"time_output\": %.3f}",
+            wall, cputime(), core->time_init_runners, core->time_wait_runners, core->time_load_db, core->time_process_db,
+            core->time_parse, core->time_preproc, core->time_runners, core->time_sync, core->time_postproc,
+            core->time_output);
+
+    fprintf(fp, ",\n  \"runners\": [");
+    for (size_t i = 0; i < runner_stats.size(); ++i) {
+        const runner_stat_t *ts = runner_stats[i];
+        fprintf(fp, "%s\n    {\"time_accept\": %.3f, \"time_basecall\": %.3f, \"time_infer\": %.3f, \"time_decode\": %.3f, "
+                "\"time_decode_wait\": %.3f, \"chunks\": %" PRIu64 ", \"batches\": %" PRIu64,
+                i ? "," : "", ts->time_accept, ts->time_basecall, ts->time_infer, ts->time_decode, ts->time_decode_wait,
+                ts->num_chunks, ts->num_batches);
+        write_model_stats(fp, core, ts);
+        fputc('}', fp);
+    }
+    fprintf(fp, "\n  ]");
+
+    // rates are over the wall time of the run, and over the time the runners were busy
+    fprintf(fp, ",\n  \"throughput\": {\"samples_per_sec\": %.1f, \"bases_per_sec\": %.1f, \"chunks_per_sec\": %.1f, "
+            "\"reads_per_sec\": %.2f, \"runner_samples_per_sec\": %.1f}",
+            per_sec(core->total_samples, wall), per_sec(core->total_bases, wall), per_sec(chunks, wall),
+            per_sec(core->total_reads, wall), per_sec(core->total_samples, core->time_runners));
+
+    // the share of the model input that is overlap or repeat padding rather than new signal, and how full the
+    // forward passes were
+    const double chunk_input = (double)chunks * core->chunk_size;
+    fprintf(fp, ",\n  \"chunk_padding_ratio\": %.4f,\n  \"batch_occupancy\": %.4f,\n  \"peak_rss_bytes\": %ld\n}\n",
+            chunk_input > 0 ? 1.0 - core->chunked_samples / chunk_input : 0.0,
+            batches > 0 ? (double)chunks / ((double)batches * opt->gpu_batch_size) : 0.0,
+            peakrss());
+
+    if (fclose(fp) != 0) {
+        ERROR("error writing report %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,17 @@
+/* @file report.h
+**
+** machine-readable JSON report of a basecalling run, written with --report
+** @@
+******************************************************************************/
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "slorado.h"
+
+/* write the configuration, the stage timers of core and its runners, the read totals of out and the throughput derived
+   from them to path. realtime0 is when the run started */
+void write_report(const char *path, const core_t *core, const output_t *out, const char *model, const char *data,
+                  const char *cmdline, double realtime0);
+
+#endif
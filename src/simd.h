@@ -0,0 +1,95 @@
+/* @file simd.h
+**
+** portable 4-wide float vectors (GCC/Clang vector extensions) used by the CPU kernels
+** maps onto SSE2 on x86_64 and NEON on ARM64 without extra compiler flags
+** @@
+******************************************************************************/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define VF32_WIDTH 4
+
+typedef float vf32_t __attribute__((vector_size(16)));
+typedef int32_t vi32_t __attribute__((vector_size(16)));
+
+static inline vf32_t vf32_set1(float x) {
+    vf32_t v = {x, x, x, x};
+    return v;
+}
+
+static inline vi32_t vi32_set1(int32_t x) {
+    vi32_t v = {x, x, x, x};
+    return v;
+}
+
+// unaligned load/store, compiles down to a single vector move
+static inline vf32_t vf32_load(const float *p) {
+    vf32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void vf32_store(float *p, vf32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline vf32_t vf32_select(vi32_t mask, vf32_t a, vf32_t b) {
+    return (vf32_t)(((vi32_t)a & mask) | ((vi32_t)b & ~mask));
+}
+
+static inline vf32_t vf32_min(vf32_t a, vf32_t b) {
+    return vf32_select(a < b, a, b);
+}
+
+static inline vf32_t vf32_max(vf32_t a, vf32_t b) {
+    return vf32_select(a > b, a, b);
+}
+
+static inline float vf32_hsum(vf32_t v) {
+    return (v[0] + v[1]) + (v[2] + v[3]);
+}
+
+static inline float vf32_hmax(vf32_t v) {
+    float m = v[0];
+    for (int i = 1; i < VF32_WIDTH; ++i) {
+        m = v[i] > m ? v[i] : m;
+    }
+    return m;
+}
+
+// exp(x) with the cephes expf polynomial, max relative error ~2 ulp
+// rounding to nearest is done with the 1.5*2^23 trick to avoid int<->float vector conversions
+static inline vf32_t vf32_exp(vf32_t x) {
+    const vf32_t magic = vf32_set1(12582912.0f);
+    x = vf32_min(x, vf32_set1(88.0f));
+    x = vf32_max(x, vf32_set1(-87.0f));
+
+    vf32_t fx = x * vf32_set1(1.44269504088896341f) + magic;
+    vi32_t n = (vi32_t)fx - (vi32_t)magic;
+    fx = fx - magic;
+
+    x = x - fx * vf32_set1(0.693359375f);
+    x = x - fx * vf32_set1(-2.12194440e-4f);
+
+    vf32_t y = vf32_set1(1.9875691500e-4f);
+    y = y * x + vf32_set1(1.3981999507e-3f);
+    y = y * x + vf32_set1(8.3334519073e-3f);
+    y = y * x + vf32_set1(4.1665795894e-2f);
+    y = y * x + vf32_set1(1.6666665459e-1f);
+    y = y * x + vf32_set1(5.0000001201e-1f);
+    y = y * x * x + x + vf32_set1(1.0f);
+
+    vi32_t pow2n = (n + vi32_set1(127)) << 23;
+    return y * (vf32_t)pow2n;
+}
+
+// x * sigmoid(x)
+static inline vf32_t vf32_silu(vf32_t x) {
+    return x / (vf32_set1(1.0f) + vf32_exp(-x));
+}
+
+#endif
@@ -43,18 +43,25 @@ SOFTWARE.
 
 #include "basecall.h"
 #include "writer.h"
+#include "output.h"
+#include "cpu_kernels.h"
+#include "demux.h"
+#include "trim.h"
+#include "progress.h"
+#include "model_pack.h"
 
 #include <sys/wait.h>
 #include <unistd.h>
 #include <vector>
-#include <algorithm>
 
 void init_runners(core_t* core, opt_t *opt, char *model);
+void wait_runners(core_t* core);
 void free_runners(core_t *core);
 void init_chunk_db(db_t *db);
 void free_chunk_db(db_t *db);
 void preprocess_signal(core_t* core, db_t* db, int32_t i);
-void stitch_chunks(chunk_db_t *chunk_db, size_t i, std::string &sequence, std::string &qstring);
+size_t stitch_chunks(chunk_db_t *chunk_db, size_t i, bool reverse, char **sequence, char **qstring);
+size_t stitch_moves(chunk_db_t *chunk_db, size_t i, uint8_t **moves);
 
 /* initialise the core data structure */
 core_t* init_core(char *slow5file, opt_t opt, char *model, double realtime0) {
@@ -77,7 +84,9 @@ core_t* init_core(char *slow5file, opt_t opt, char *model, double realtime0) {
         model_config = load_lstm_model_config(model);
     }
     model_config.model_path = std::string(model);
-    model_config.sample_type = get_sample_type_from_model_name(model_config.model_path);
+    // a pack keeps the name of the model directory it was made from, which carries the sample type
+    model_pack_t *pack = model_pack_get(model);
+    model_config.sample_type = get_sample_type_from_model_name(pack ? pack->header->model_name : model_config.model_path);
 
     core->model_stride = static_cast<size_t>(model_config.stride);
     core->chunk_size = opt.chunk_size - (opt.chunk_size % core->model_stride);
@@ -87,12 +96,17 @@ core_t* init_core(char *slow5file, opt_t opt, char *model, double realtime0) {
     core->decoder_opts.q_scale = model_config.qscale;
 
     core->model_config = new CRFModelConfig(model_config);
+
+    if (opt.barcode_arrangement != NULL) {
+        core->barcode_kit = load_barcode_kit(opt.barcode_arrangement, opt.barcode_sequences);
+    }
+    if (opt.trim_sequences != NULL) {
+        core->trim_set = load_trim_sequences(opt.trim_sequences);
+    }
     LOG_TRACE("%s", "model config loaded");
 
-    core->time_init_runners -= realtime();
+    // returns straight away, the first process_db waits for the runners
     init_runners(core, &opt, model);
-    core->time_init_runners += realtime();
-    LOG_DEBUG("%s", "successfully initialized runners");
 
     core->sum_bytes=0;
     core->total_reads=0; // total number mapped entries in the bam file (after filtering based on flags, mapq etc)
@@ -103,12 +117,21 @@ core_t* init_core(char *slow5file, opt_t opt, char *model, double realtime0) {
 
 /* free the core data structure */
 void free_core(core_t* core, opt_t opt) {
+    wait_runners(core);
     free_runners(core);
 
     slow5_close(core->sp);
     delete core->runners;
     delete core->runner_stats;
     delete core->model_config;
+    model_pack_close_all();
+    if (core->trim_set) {
+        free_trim_sequences(core->trim_set);
+    }
+    if (core->barcode_kit) {
+        free_barcode_kit(core->barcode_kit);
+    }
+    free_thread_plan(&core->thread_plan);
     free(core);
 }
 
@@ -134,6 +157,24 @@ db_t* init_db(core_t* core) {
     init_chunk_db(db);
     db->sequence = new std::vector<char *>(db->capacity_rec, NULL);
     db->qstring = new std::vector<char *>(db->capacity_rec, NULL);
+    db->seq_len = (size_t *)calloc(db->capacity_rec, sizeof(size_t));
+    MALLOC_CHK(db->seq_len);
+    db->trimmed_samples = (int64_t *)calloc(db->capacity_rec, sizeof(int64_t));
+    MALLOC_CHK(db->trimmed_samples);
+    db->chunked_samples = (int64_t *)calloc(db->capacity_rec, sizeof(int64_t));
+    MALLOC_CHK(db->chunked_samples);
+    db->moves = (uint8_t **)calloc(db->capacity_rec, sizeof(uint8_t *));
+    MALLOC_CHK(db->moves);
+    db->moves_len = (size_t *)calloc(db->capacity_rec, sizeof(size_t));
+    MALLOC_CHK(db->moves_len);
+    db->mean_qscore = (float *)calloc(db->capacity_rec, sizeof(float));
+    MALLOC_CHK(db->mean_qscore);
+    db->barcode = (int32_t *)calloc(db->capacity_rec, sizeof(int32_t));
+    MALLOC_CHK(db->barcode);
+    db->trimmed_front = (int32_t *)calloc(db->capacity_rec, sizeof(int32_t));
+    MALLOC_CHK(db->trimmed_front);
+    db->trimmed_rear = (int32_t *)calloc(db->capacity_rec, sizeof(int32_t));
+    MALLOC_CHK(db->trimmed_rear);
 
     db->total_reads = 0;
     db->sum_bytes = 0;
@@ -188,25 +229,109 @@ void parse_single(core_t* core,db_t* db, int32_t i) {
     }
 }
 
+/* bases called in a move table, one per move */
+static inline size_t count_moves(const uint8_t *moves, size_t len) {
+    size_t n = 0;
+    for (size_t j = 0; j < len; ++j) {
+        n += moves[j];
+    }
+    return n;
+}
+
+/* cut front and rear bases off read i, with the stretch of the move table they were called from. the move table follows
+   the signal, which runs against the sequence for RNA */
+static void trim_read(core_t* core, db_t* db, int32_t i, size_t front, size_t rear, bool reverse) {
+    size_t len = db->seq_len[i] - front - rear;
+    char *seq = (*db->sequence)[i];
+    char *qual = (*db->qstring)[i];
+
+    // the cuts below count one base per move, a table that disagrees with the sequence cannot be cut
+    if (db->moves[i] && count_moves(db->moves[i], db->moves_len[i]) != db->seq_len[i]) {
+        WARNING("Read %s has %zu moves for %zu bases, its move table is dropped", db->slow5_rec[i]->read_id,
+                count_moves(db->moves[i], db->moves_len[i]), db->seq_len[i]);
+        free(db->moves[i]);
+        db->moves[i] = NULL;
+        db->moves_len[i] = 0;
+    }
+
+    memmove(seq, seq + front, len);
+    memmove(qual, qual + front, len);
+    seq[len] = '\0';
+    qual[len] = '\0';
+
+    if (db->moves[i]) {
+        uint8_t *mv = db->moves[i];
+        size_t sig_front = reverse ? rear : front;
+        size_t sig_end = sig_front + len;
+        // a base starts at each move, keep from the first kept base up to the first base trimmed off the end
+        size_t start = sig_front > 0 ? db->moves_len[i] : 0;
+        size_t end = db->moves_len[i];
+        size_t base = 0;
+        for (size_t j = 0; j < db->moves_len[i]; ++j) {
+            if (mv[j] == 0) {
+                continue;
+            }
+            if (base == sig_front && sig_front > 0) {
+                start = j;
+            }
+            if (base == sig_end) {
+                end = j;
+                break;
+            }
+            base++;
+        }
+        start = start < end ? start : end;
+        memmove(mv, mv + start, end - start);
+        db->moves_len[i] = end - start;
+        db->trimmed_samples[i] += start * core->model_stride;
+    }
+
+    db->seq_len[i] = len;
+    db->trimmed_front[i] = front;
+    db->trimmed_rear[i] = rear;
+}
+
 void postprocess_signal(core_t* core, db_t* db, int32_t i) {
     slow5_rec_t* rec = db->slow5_rec[i];
     uint64_t len_raw_signal = rec->len_raw_signal;
 
+    // a batch slot is reused, a read without signal must not inherit what the previous read left there
+    db->mean_qscore[i] = 0;
+    db->barcode[i] = BARCODE_NONE;
+    db->trimmed_front[i] = 0;
+    db->trimmed_rear[i] = 0;
+
     if (len_raw_signal > 0) {
-        std::string sequence;
-        std::string qstring;
-        stitch_chunks(db->chunk_db, i, sequence, qstring);
-        
-        if (is_rna(core->model_config->sample_type)) {
-            std::reverse(sequence.begin(), sequence.end());
-            std::reverse(qstring.begin(), qstring.end());
+        bool reverse = is_rna(core->model_config->sample_type);
+        db->seq_len[i] = stitch_chunks(db->chunk_db, i, reverse, &(*db->sequence)[i], &(*db->qstring)[i]);
+        if ((core->opt.flag & SLORADO_EMV) && (core->opt.out_format == WRITER_SAM || core->opt.out_format == WRITER_BAM)) {
+            db->moves_len[i] = stitch_moves(db->chunk_db, i, &db->moves[i]);
+            assert(count_moves(db->moves[i], db->moves_len[i]) == db->seq_len[i]);
+        }
+
+        // the first bases are unreliable and left out, unless the read is too short to have anything else
+        size_t start = core->model_config->mean_qscore_start_pos;
+        if (start >= db->seq_len[i]) {
+            start = 0;
         }
+        db->mean_qscore[i] = mean_qscore_cpu((*db->qstring)[i] + start, db->seq_len[i] - start);
 
-        (*db->sequence)[i] = strdup(sequence.c_str());
-        assert((*db->sequence)[i] != NULL);
+        // classified here rather than at output, so it runs on the worker threads alongside inference
+        db->barcode[i] = core->barcode_kit ? classify_barcode(core->barcode_kit, (*db->sequence)[i], db->seq_len[i]) : BARCODE_NONE;
 
-        (*db->qstring)[i] = strdup(qstring.c_str());
-        assert((*db->qstring)[i] != NULL);
+        // only the --trim-sequences matches are cut, after classification has seen the untrimmed ends
+        if (core->trim_set) {
+            size_t front, rear;
+            find_trim(core->trim_set, (*db->sequence)[i], db->seq_len[i], &front, &rear);
+            if (front + rear > 0) {
+                trim_read(core, db, i, front, rear, reverse);
+            }
+        }
+
+        if (core->progress) {
+            progress_add(core->progress->reads, 1);
+            progress_add(core->progress->bases, db->seq_len[i]);
+        }
     }
 }
 
@@ -225,6 +350,11 @@ void process_db(core_t* core, db_t* db) {
     core->time_preproc += (b-a);
     LOG_DEBUG("%s", "preprocessed reads");
 
+    a = realtime();
+    wait_runners(core);
+    b = realtime();
+    core->time_wait_runners += (b - a);
+
     a = realtime();
     basecall_db(core, db);
     b = realtime();
@@ -245,15 +375,31 @@ void process_db(core_t* core, db_t* db) {
 void output_db(core_t* core, db_t* db) {
     double output_start = realtime();
 
+    std::vector<read_out_t> reads(db->n_rec);
     int32_t i = 0;
     for (i = 0; i < db->n_rec; i++) {
-        if(db->slow5_rec[i]->len_raw_signal>0){
-            write_to_file(core->opt.out, (*db->sequence)[i], (*db->qstring)[i], db->slow5_rec[i]->read_id, (core->opt.flag & SLORADO_EFQ) != 0);
+        slow5_rec_t *rec = db->slow5_rec[i];
+        reads[i] = {
+            rec->read_id, (*db->sequence)[i], (*db->qstring)[i], db->seq_len[i],
+            db->moves[i], db->moves_len[i], (int32_t)core->model_stride, db->trimmed_samples[i],
+            rec->len_raw_signal, rec->sampling_rate > 0 ? rec->len_raw_signal / rec->sampling_rate : 0.0, db->mean_qscore[i],
+            db->barcode[i], core->barcode_kit == NULL || db->barcode[i] == BARCODE_NONE ? NULL : barcode_name(core->barcode_kit, db->barcode[i]),
+            db->trimmed_front[i], db->trimmed_rear[i]
+        };
+        if (rec->len_raw_signal > 0) {
+            core->total_samples += rec->len_raw_signal;
+            core->total_bases += db->seq_len[i];
+            core->chunked_samples += db->chunked_samples[i];
         }
     }
+    write_output(core->output, reads.data(), db->n_rec, core->total_reads);
 
     core->sum_bytes += db->sum_bytes;
     core->total_reads += db->total_reads;
+    core->num_batches++;
+    if (core->progress) {
+        progress_add(core->progress->bytes, db->sum_bytes);
+    }
 
     double output_end = realtime();
     core->time_output += (output_end-output_start);
@@ -267,6 +413,11 @@ void free_db_tmp(db_t* db) {
         free(db->mem_records[i]);
         free((*db->sequence)[i]);
         free((*db->qstring)[i]);
+        (*db->sequence)[i] = NULL;
+        (*db->qstring)[i] = NULL;
+        free(db->moves[i]);
+        db->moves[i] = NULL;
+        db->moves_len[i] = 0;
     }
 }
 
@@ -283,6 +434,15 @@ void free_db(db_t* db) {
     free(db->means);
     delete db->sequence;
     delete db->qstring;
+    free(db->seq_len);
+    free(db->trimmed_samples);
+    free(db->chunked_samples);
+    free(db->moves);
+    free(db->moves_len);
+    free(db->mean_qscore);
+    free(db->barcode);
+    free(db->trimmed_front);
+    free(db->trimmed_rear);
     free_chunk_db(db);
     free(db);
 }
@@ -294,6 +454,7 @@ void init_opt(opt_t* opt) {
     opt->gpu_batch_size = 500;
     opt->batch_size_bytes = 500*1000*1000;
     opt->num_thread = 8;
+    opt->num_runners = 1;
 
     opt->debug_break = -1;
 
@@ -306,8 +467,23 @@ void init_opt(opt_t* opt) {
     opt->chunk_size = 10000;
     opt->overlap = 150;
 
-    opt->out = stdout;
+    opt->out_shards = 1;
+    opt->out_format = -1; // from the -o suffix
+    opt->out_codec = -1;
+    opt->compress_level = -1;
+    opt->compress_threads = 4;
+    opt->write_buffer = WRITER_BUF_SIZE;
+    opt->barcode_arrangement = NULL;
+    opt->barcode_sequences = NULL;
+    opt->trim_sequences = NULL;
+    opt->report_path = NULL;
+    opt->progress_interval = 0;
+    opt->status_path = NULL;
+    opt->min_qscore = 0;
+    opt->fail_path = NULL;
+    opt->summary_path = NULL;
 
     opt->flag |= SLORADO_EFQ;
+    opt->flag |= SLORADO_EMV;
 }
 
@@ -35,6 +35,7 @@ SOFTWARE.
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <slow5/slow5.h>
 #include <openfish/openfish.h>
 #include <vector>
@@ -52,6 +53,9 @@ SOFTWARE.
 #define SLORADO_ACC 0x002 // accelerator enable
 #define SLORADO_EFQ 0x004 // emit fastq enable
 #define SLORADO_FLS 0x008 // flash attention enable
+#define SLORADO_SHW 0x010 // shared read-only weights enable
+#define SLORADO_PIN 0x020 // pin threads to the CPUs of the thread plan
+#define SLORADO_EMV 0x040 // emit the move table in SAM/BAM
 
 #define WORK_STEAL 1 // simple work stealing enabled or not (no work stealing mean no load balancing)
 #define STEAL_THRESH 1 // stealing threshold
@@ -64,16 +68,39 @@ typedef struct {
     int64_t batch_size_bytes;   // max bytes loaded at once: B
 
     int32_t num_thread;         // number of threads used: t
+    int32_t num_runners;        // number of model runners on the CPU: r
+    int32_t num_thread_torch;   // torch intra-op threads per runner, 0 to derive from -t: threads-torch
+    int32_t num_thread_decode;  // decoder threads per runner, 0 to derive from -t: threads-decode
     int32_t debug_break;
 
-    const char *out_path;       // path to output file: o
-    FILE *out;
+    const char *out_path;       // path to output file, or directory with out_shards: o
+    int32_t out_shards;         // number of output files the reads are split over: out-shards
+    int8_t out_format;          // WRITER_FASTQ, WRITER_SAM or WRITER_BAM, -1 from the -o suffix: output-format
+    int8_t out_codec;           // ZW_NONE, ZW_BGZF or ZW_ZSTD, -1 from the -o suffix: compression
+    int32_t compress_level;     // compression level, -1 for the codec's default: compress-level
+    int32_t compress_threads;   // compression threads: compress-threads
+    int64_t write_buffer;       // bytes formatted per output file before one write: write-buffer
+    int64_t rotate_reads;       // start a new output segment after this many reads, 0 for never: rotate-output
+    int64_t rotate_bytes;       // or after this many bytes before compression: rotate-output with a K/M/G suffix
+    const char *barcode_arrangement; // demultiplex against this arrangement TOML, NULL for none: barcode-arrangement
+    const char *barcode_sequences;   // FASTA with the barcodes the arrangement names: barcode-sequences
+    const char *trim_sequences;      // FASTA with the adapters and primers to trim, NULL for none: trim-sequences
+    float min_qscore;           // reads with a lower mean Q-score go to the fail output: min-qscore
+    const char *fail_path;      // fail output: fail-output
+    const char *summary_path;   // per-read summary TSV, NULL for none: summary
+    const char *report_path;    // JSON run report, NULL for none: report
+    float progress_interval;    // seconds between progress lines on stderr, 0 for none: progress
+    const char *status_path;    // status file rewritten with the progress, NULL for none: status-file
 
     const char *device;         // specified device: x
     size_t chunk_size;          // size of chunks: c
     int32_t overlap;            // overlap: p
 } opt_t;
 
+typedef struct output output_t;
+typedef struct barcode_kit barcode_kit_t;
+typedef struct trim_set trim_set_t;
+typedef struct progress progress_t;
 typedef struct chunk_sig chunk_sig_t;
 typedef struct chunk_res chunk_res_t;
 typedef struct chunk_db chunk_db_t;
@@ -94,6 +121,15 @@ typedef struct {
 
     std::vector<char *> *sequence;
     std::vector<char *> *qstring;
+    size_t *seq_len;
+    int64_t *trimmed_samples;   // samples trimmed off the start of each signal
+    int64_t *chunked_samples;   // samples of each signal split into chunks
+    uint8_t **moves;            // stitched move tables, only when they are written out
+    size_t *moves_len;
+    float *mean_qscore;
+    int32_t *barcode;           // BARCODE_NONE without an arrangement
+    int32_t *trimmed_front;     // adapter and primer bases cut off the start of each sequence
+    int32_t *trimmed_rear;      // and off its end
 
     // stats
     int64_t sum_bytes;
@@ -131,14 +167,28 @@ typedef struct {
     double time_basecall;
     double time_infer;
     double time_decode;
+    double time_decode_wait; // time the inference loop was blocked on the previous batch's decode
 
     void *model_stats;
 
     uint64_t total_dp;
+    uint64_t num_chunks;
+    uint64_t num_batches;       // forward passes, each of at most gpu_batch_size chunks
 } runner_stat_t;
 
 typedef struct runner runner_t;
 
+/* how the -t threads are split between the stages, see init_thread_plan
+   the workers run between the basecalling phases and get every thread, the runners share them while basecalling */
+typedef struct {
+    int32_t num_cpus;           // CPUs the process may run on
+    int32_t *cpus;              // their ids
+    int32_t workers;            // parse, preprocess and postprocess threads
+    int32_t runners;
+    int32_t torch;              // intra-op threads per runner
+    int32_t decode;             // decoder threads per runner, overlap with the next batch's inference
+} thread_plan_t;
+
 /* core data structure (mostly static data throughout the program lifetime) */
 typedef struct {
     // slow5
@@ -154,12 +204,16 @@ typedef struct {
     // create model runner
     // only one per GPU is used for now
     std::vector<runner_t *> *runners;
+    pthread_t runner_init_tid;  // initialises the runners in the background, see wait_runners
+    int8_t runners_pending;
+    thread_plan_t thread_plan;
 
     // realtime0
     double realtime0;
 
     // timings
     double time_init_runners;
+    double time_wait_runners;   // part of time_init_runners that was not hidden behind the first batch
     double time_load_db;
     double time_process_db;
     double time_parse;
@@ -172,9 +226,19 @@ typedef struct {
     // stats for each runner
     std::vector<runner_stat_t *> *runner_stats;
 
+    // output, set up by the caller of init_core, NULL when nothing is written
+    output_t *output;
+    barcode_kit_t *barcode_kit; // NULL when not demultiplexing
+    trim_set_t *trim_set;       // NULL when not trimming
+    progress_t *progress;       // set up by the caller of init_core, NULL when progress is not reported
+
     // stats, set by output_db
     int64_t sum_bytes;
     int64_t total_reads; // total number mapped entries in the bam file (after filtering based on flags, mapq etc)
+    int64_t total_samples;
+    int64_t total_bases;
+    int64_t chunked_samples;
+    int32_t num_batches;
 } core_t;
 
 /* argument wrapper for the multithreaded framework used for data processing */
@@ -223,6 +287,18 @@ void work_db(core_t* core, db_t* db, void (*func)(core_t*, db_t*, int));
 /* process a data batch */
 void process_db(core_t* core, db_t* db);
 
+/* split the threads of opt between the workers and num_runners runners */
+void init_thread_plan(thread_plan_t *plan, const opt_t *opt, int32_t num_runners);
+void print_thread_plan(FILE *fp, const thread_plan_t *plan, uint64_t flag);
+void free_thread_plan(thread_plan_t *plan);
+
+/* bind the calling thread (and the threads it creates later) to n CPUs of the plan starting at the first-th */
+void pin_thread(const thread_plan_t *plan, int32_t first, int32_t n);
+
+/* first CPUs of runner r's torch and decoder threads in the plan */
+static inline int32_t runner_torch_cpu(const thread_plan_t *plan, int32_t r) { return r * (plan->torch + plan->decode); }
+static inline int32_t runner_decode_cpu(const thread_plan_t *plan, int32_t r) { return r * (plan->torch + plan->decode) + plan->torch; }
+
 /* align a single read specified by index i*/
 void process_single(core_t* core, db_t* db, int32_t i);
 
@@ -29,6 +29,10 @@ SOFTWARE.
 ******************************************************************************/
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include "slorado.h"
 #include "error.h"
 #include "misc.h"
@@ -56,6 +60,9 @@ static inline int32_t steal_work(pthread_arg_t* all_args, int32_t n_threads) {
 void* pthread_single(void* voidargs) {
     int32_t i;
     pthread_arg_t* args = (pthread_arg_t*)voidargs;
+    if (args->core->opt.flag & SLORADO_PIN) {
+        pin_thread(&args->core->thread_plan, args->thread_index, 1);
+    }
     db_t* db = args->db;
     core_t* core = args->core;
 
@@ -105,6 +112,7 @@ void pthread_db(core_t* core, db_t* db, void (*func)(core_t*, db_t*, int)){
             pt_args[t].endi = i;
         }
         pt_args[t].func=func;
+        pt_args[t].thread_index = t;
     #ifdef WORK_STEAL
         pt_args[t].all_pthread_args =  (void*)pt_args;
     #endif
@@ -136,3 +144,92 @@ void work_db(core_t* core, db_t* db, void (*func)(core_t*, db_t*, int)) {
         pthread_db(core,db,func);
     }
 }
+
+void init_thread_plan(thread_plan_t *plan, const opt_t *opt, int32_t num_runners) {
+    memset(plan, 0, sizeof(thread_plan_t));
+
+    // respect taskset and cgroup CPU sets rather than assuming CPUs 0..n-1
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        ERROR("%s", "could not get the CPU affinity of the process");
+        exit(EXIT_FAILURE);
+    }
+    plan->cpus = (int32_t *)malloc(CPU_SETSIZE * sizeof(int32_t));
+    MALLOC_CHK(plan->cpus);
+    for (int32_t c = 0; c < CPU_SETSIZE; ++c) {
+        if (CPU_ISSET(c, &set)) {
+            plan->cpus[plan->num_cpus++] = c;
+        }
+    }
+
+    plan->workers = opt->num_thread;
+    plan->runners = num_runners;
+
+    // the decoder of one batch overlaps the inference of the next, so a runner's share is split between the two
+    // inference is the heavier of the two, the decoder gets a quarter unless told otherwise
+    int32_t share = opt->num_thread / num_runners;
+    share = share > 0 ? share : 1;
+    plan->decode = opt->num_thread_decode > 0 ? opt->num_thread_decode : share / 4;
+    plan->decode = plan->decode > 0 ? plan->decode : 1;
+    plan->torch = opt->num_thread_torch > 0 ? opt->num_thread_torch : share - plan->decode;
+    plan->torch = plan->torch > 0 ? plan->torch : 1;
+
+    int32_t total = num_runners * (plan->torch + plan->decode);
+    if (total > plan->num_cpus) {
+        WARNING("%d runners x (%d torch + %d decode) threads oversubscribe the %d available CPUs", num_runners, plan->torch, plan->decode, plan->num_cpus);
+    }
+}
+
+/* CPU ids of plan entries first..first+n-1 as a list of ranges, e.g. 0-5,12 */
+static void sprint_cpus(char *buf, size_t size, const thread_plan_t *plan, int32_t first, int32_t n) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int32_t i = 0; i < n && len < size; ) {
+        int32_t lo = plan->cpus[(first + i) % plan->num_cpus];
+        int32_t hi = lo;
+        ++i;
+        while (i < n && plan->cpus[(first + i) % plan->num_cpus] == hi + 1) {
+            ++hi;
+            ++i;
+        }
+        if (lo == hi) {
+            len += snprintf(buf + len, size - len, "%s%d", len ? "," : "", lo);
+        } else {
+            len += snprintf(buf + len, size - len, "%s%d-%d", len ? "," : "", lo, hi);
+        }
+    }
+}
+
+void print_thread_plan(FILE *fp, const thread_plan_t *plan, uint64_t flag) {
+    fprintf(fp, "thread plan:        %d workers, %d runner%s x (%d torch + %d decode) threads on %d CPUs%s\n",
+            plan->workers, plan->runners, plan->runners > 1 ? "s" : "", plan->torch, plan->decode, plan->num_cpus,
+            (flag & SLORADO_PIN) ? ", pinned" : "");
+    if (!(flag & SLORADO_PIN)) {
+        return;
+    }
+    char torch_cpus[256];
+    char decode_cpus[256];
+    for (int32_t r = 0; r < plan->runners; ++r) {
+        sprint_cpus(torch_cpus, sizeof(torch_cpus), plan, runner_torch_cpu(plan, r), plan->torch);
+        sprint_cpus(decode_cpus, sizeof(decode_cpus), plan, runner_decode_cpu(plan, r), plan->decode);
+        fprintf(fp, "                    runner %d: torch on CPUs %s, decode on CPUs %s\n", r, torch_cpus, decode_cpus);
+    }
+}
+
+void free_thread_plan(thread_plan_t *plan) {
+    free(plan->cpus);
+    plan->cpus = NULL;
+}
+
+void pin_thread(const thread_plan_t *plan, int32_t first, int32_t n) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int32_t i = 0; i < n && i < plan->num_cpus; ++i) {
+        CPU_SET(plan->cpus[(first + i) % plan->num_cpus], &set);
+    }
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret != 0) {
+        WARNING("could not pin thread to %d CPUs: %s", n, strerror(ret));
+    }
+}
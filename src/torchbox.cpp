@@ -113,16 +113,27 @@ void init_runner(
     runner->tensor_opts = torch::TensorOptions().dtype(dtype).device(device);
     if (core->model_config->tx != NULL) {
         tx_stats_t *model_stats = init_tx_stats();
-        runner->module = load_tx_model(*core->model_config, runner->tensor_opts, model_stats, (core->opt.flag & SLORADO_FLS) != 0);
+        runner->module = load_tx_model(*core->model_config, runner->tensor_opts, model_stats, (core->opt.flag & SLORADO_FLS) != 0, (core->opt.flag & SLORADO_SHW) != 0, batch_size, core->chunk_size);
         (*core->runner_stats)[runner_idx]->model_stats = model_stats;
     } else {
         lstm_stats_t *model_stats = init_lstm_stats();
-        runner->module = load_lstm_model(*core->model_config, runner->tensor_opts);
+        runner->module = load_lstm_model(*core->model_config, runner->tensor_opts, (core->opt.flag & SLORADO_SHW) != 0, batch_size, core->chunk_size);
         (*core->runner_stats)[runner_idx]->model_stats = model_stats;
     }
     LOG_TRACE("%s", "model populated");
 
-    runner->input_tensor = torch::zeros({batch_size, 1, (int64_t)core->chunk_size}, torch::TensorOptions().dtype(dtype).device(torch::kCPU));
+    // page-locked on the host when feeding a GPU so that the per-batch upload is a plain DMA
+    runner->input_tensor = torch::zeros({batch_size, 1, (int64_t)core->chunk_size}, torch::TensorOptions().dtype(dtype).device(torch::kCPU).pinned_memory(device != "cpu"));
+    if (device != "cpu") {
+        runner->device_input = torch::empty({batch_size, 1, (int64_t)core->chunk_size}, runner->tensor_opts);
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        runner->slots[i].core = core;
+        runner->slots[i].runner = runner_idx;
+        runner->slots[i].busy = 0;
+    }
+    runner->cur_slot = 0;
 
     LOG_DEBUG("fully initialized model runner for device %s", device.c_str());
 }
@@ -132,17 +143,54 @@ void init_runner_stat(runner_stat_t *time_stamps) {
     memset(time_stamps, 0, sizeof(runner_stat_t));
 }
 
+typedef struct {
+    core_t* core;
+    char *model;
+    std::string device;
+    int batch_size;
+    torch::ScalarType dtype;
+    int runner_idx;
+} runner_init_arg_t;
+
+static void* pthread_init_runner(void* voidargs) {
+    runner_init_arg_t* args = (runner_init_arg_t*)voidargs;
+    core_t* core = args->core;
+    init_runner(core, (*core->runners)[args->runner_idx], args->model, args->device, args->batch_size, args->dtype, args->runner_idx);
+    pthread_exit(0);
+}
+
+/* initialises every runner at once, runs in the background while the first batch is loaded */
+static void* pthread_init_runners(void* voidargs) {
+    std::vector<runner_init_arg_t> *args = (std::vector<runner_init_arg_t> *)voidargs;
+    core_t* core = (*args)[0].core;
+    double t0 = realtime();
+
+    size_t num_runners = args->size();
+    std::vector<pthread_t> tids(num_runners);
+    for (size_t t = 0; t < num_runners; ++t) {
+        int ret = pthread_create(&tids[t], NULL, pthread_init_runner, (void*)(&(*args)[t]));
+        NEG_CHK(ret);
+    }
+    for (size_t t = 0; t < num_runners; ++t) {
+        int ret = pthread_join(tids[t], NULL);
+        NEG_CHK(ret);
+    }
+
+    core->time_init_runners += realtime() - t0;
+    delete args;
+    pthread_exit(0);
+}
+
 void init_runners(core_t* core, opt_t *opt, char *model) {
     core->runners = new std::vector<runner_t *>();
     core->runner_stats = new std::vector<runner_stat_t *>();
-    
+    std::vector<runner_init_arg_t> *args = new std::vector<runner_init_arg_t>();
+
     if (strcmp(opt->device, "cpu") == 0) {
         std::string device = opt->device;
-        core->runner_stats->push_back((runner_stat_t *)malloc(sizeof(runner_stat_t)));
-        init_runner_stat((*core->runner_stats).back());
-
-        core->runners->push_back(new runner_t());
-        init_runner(core, (*core->runners).back(), model, device, opt->gpu_batch_size, torch::kF32, 0);
+        for (int runner_idx = 0; runner_idx < opt->num_runners; ++runner_idx) {
+            args->push_back({core, model, device, opt->gpu_batch_size, torch::kF32, runner_idx});
+        }
     } else {
 #ifdef USE_GPU
         std::vector<std::string> devices;
@@ -155,10 +203,7 @@ void init_runners(core_t* core, opt_t *opt, char *model) {
 
         int runner_idx = 0;
         for (auto device: devices) {
-            core->runner_stats->push_back((runner_stat_t *)malloc(sizeof(runner_stat_t)));
-            init_runner_stat((*core->runner_stats).back());
-            core->runners->push_back(new runner_t());
-            init_runner(core, (*core->runners).back(), model, device, opt->gpu_batch_size, torch::kF16, runner_idx++);
+            args->push_back({core, model, device, opt->gpu_batch_size, torch::kF16, runner_idx++});
         }
 #else
         ERROR("Invalid device: %s. Please compile again for GPU", opt->device);
@@ -166,11 +211,40 @@ void init_runners(core_t* core, opt_t *opt, char *model) {
 #endif
     }
 
+    // the containers are filled up front so that the runner threads only ever touch their own entry
+    for (size_t i = 0; i < args->size(); ++i) {
+        core->runner_stats->push_back((runner_stat_t *)malloc(sizeof(runner_stat_t)));
+        MALLOC_CHK(core->runner_stats->back());
+        init_runner_stat((*core->runner_stats).back());
+        core->runners->push_back(new runner_t());
+    }
+
+    // torch's intra-op pool is sized once for the process, each runner thread gets a team of that many
+    init_thread_plan(&core->thread_plan, opt, args->size());
+    if (strcmp(opt->device, "cpu") == 0 || opt->num_thread_torch > 0) {
+        at::set_num_threads(core->thread_plan.torch);
+    }
+
     auto adjusted_chunk_size = core->chunk_size;
     if (opt->chunk_size != adjusted_chunk_size) {
         LOG_DEBUG("Adjusting chunk size to %zu", adjusted_chunk_size);
         opt->chunk_size = adjusted_chunk_size;
     }
+
+    int ret = pthread_create(&core->runner_init_tid, NULL, pthread_init_runners, (void*)args);
+    NEG_CHK(ret);
+    core->runners_pending = 1;
+}
+
+/* block until the runners started by init_runners are ready */
+void wait_runners(core_t* core) {
+    if (!core->runners_pending) {
+        return;
+    }
+    int ret = pthread_join(core->runner_init_tid, NULL);
+    NEG_CHK(ret);
+    core->runners_pending = 0;
+    LOG_DEBUG("%s", "successfully initialized runners");
 }
 
 void free_runners(core_t *core) {
@@ -202,11 +276,19 @@ void init_chunk_db(db_t *db) {
     MALLOC_CHK(db->chunk_db);
     db->chunk_db->chunks_res = new std::vector<std::vector<chunk_res_t>>(db->capacity_rec, std::vector<chunk_res_t>());
     db->chunk_db->chunks_sig = new std::vector<std::vector<chunk_sig_t>>(db->capacity_rec, std::vector<chunk_sig_t>());
+    db->chunk_db->moves = NULL;
+    db->chunk_db->sequence = NULL;
+    db->chunk_db->qstring = NULL;
+    db->chunk_db->capacity = 0;
+    db->chunk_db->T = 0;
 }
 
 void free_chunk_db(db_t *db) {
     delete db->chunk_db->chunks_res;
     delete db->chunk_db->chunks_sig;
+    free(db->chunk_db->moves);
+    free(db->chunk_db->sequence);
+    free(db->chunk_db->qstring);
     free(db->chunk_db);
 }
 
@@ -226,7 +308,7 @@ std::vector<chunk_res_t> create_chunks_res(size_t tensor_size, size_t chunk_size
 
     for (size_t i = 0; i < n_chunks; ++i) {
         size_t sig_pos = std::min(step * i, tensor_size - chunk_size);
-        chunks_res.push_back({sig_pos, i, chunk_size, std::string(), std::string(), std::vector<uint8_t>()});
+        chunks_res.push_back({sig_pos, i, chunk_size, 0, NULL, NULL, NULL, 0});
     }
 
     return chunks_res;
@@ -269,8 +351,9 @@ void preprocess_signal(core_t *core, db_t *db, int32_t i) {
 
         torch::Tensor signal = tensor_from_record(rec);
 
-        scale_signal(core, signal, rec->range / rec->digitisation, rec->offset, signal_norm_params);
+        db->trimmed_samples[i] = scale_signal(core, signal, rec->range / rec->digitisation, rec->offset, signal_norm_params);
 
+        db->chunked_samples[i] = signal.size(0);
         std::vector<chunk_res_t> chunks_res = create_chunks_res(signal.size(0), core->chunk_size, opt.overlap);
         (*db->chunk_db->chunks_res)[i] = chunks_res;
 
@@ -1,6 +1,7 @@
 #ifndef TORCHBOX_H
 #define TORCHBOX_H
 
+#include <pthread.h>
 #include <torch/torch.h>
 #include "slorado.h"
 
@@ -10,9 +11,12 @@ struct chunk_res {
     size_t idx_in_read;     // order in read
     size_t raw_chunk_size;  // size in raw signal
 
-    std::string seq;
-    std::string qstring;
-    std::vector<uint8_t> moves;
+    // views into the chunk_db arena, filled in by the decoder
+    size_t arena_idx;       // chunk slot in the arena
+    uint8_t *moves;         // T entries
+    char *seq;              // num_bases entries, not null terminated
+    char *qstring;          // num_bases entries, not null terminated
+    size_t num_bases;
 };
 
 // raw signal of a chunk
@@ -23,11 +27,33 @@ struct chunk_sig {
 struct chunk_db {
     std::vector<std::vector<chunk_res_t>> *chunks_res;
     std::vector<std::vector<chunk_sig_t>> *chunks_sig;
+
+    // decoder output for every chunk in the batch, chunk k owns [k * T, (k + 1) * T) of each array
+    // grows to the largest batch seen and is reused afterwards
+    uint8_t *moves;
+    char *sequence;
+    char *qstring;
+    size_t capacity;        // in chunks
+    size_t T;               // timesteps per chunk
 };
 
+/* scores of one batch in flight between the inference loop and the decoder
+   each runner owns two, the forward pass fills one while the other is being decoded */
+typedef struct decode_slot {
+    const core_t* core;
+    int32_t runner;
+    torch::Tensor scores_TNC; // [T, N, C] on the runner's device, sized on the first batch and reused
+    std::vector<chunk_res_t *> results;
+    pthread_t tid;
+    int8_t busy;
+} decode_slot_t;
+
 struct runner {
     std::string device;
     torch::Tensor input_tensor;
+    torch::Tensor device_input; // input_tensor's counterpart on the device (GPU runners only)
+    decode_slot_t slots[2];
+    int cur_slot;
     torch::TensorOptions tensor_opts;
     torch::nn::ModuleHolder<torch::nn::AnyModule> module{nullptr};
 #ifdef USE_GPU
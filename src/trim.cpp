@@ -0,0 +1,121 @@
+/* @file trim.cpp
+**
+** adapter and primer trimming of basecalled reads
+** each sequence is searched for near the read start, and its reverse complement near the read end, with Myers'
+** bit-parallel edit distance (myers.h). the end is searched backwards so the match reports where it starts
+** @@
+******************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "trim.h"
+#include "myers.h"
+#include "error.h"
+
+struct trim_set {
+    std::vector<std::string> names;
+    std::vector<myers_pattern_t> front;  // the sequence, searched forwards from the read start
+    std::vector<myers_pattern_t> rear;   // its complement, i.e. the reverse complement reversed, searched backwards from the read end
+    std::vector<int> max_edits;
+    int window;                          // bases encoded at each end, enough for the longest sequence
+};
+
+static void add_sequence(trim_set_t *set, const std::string &name, const std::string &seq, const char *path) {
+    if (seq.empty() || seq.size() > MYERS_MAX_PATTERN) {
+        ERROR("trim sequence %s in %s is %zu bases, it should be 1 to %d", name.c_str(), path, seq.size(), MYERS_MAX_PATTERN);
+        exit(EXIT_FAILURE);
+    }
+    std::string comp(seq);
+    for (size_t i = 0; i < comp.size(); ++i) {
+        comp[i] = myers_complement(seq[i]);
+    }
+    set->names.push_back(name);
+    set->front.push_back(myers_make_pattern(seq.data(), seq.size()));
+    set->rear.push_back(myers_make_pattern(comp.data(), comp.size()));
+    set->max_edits.push_back((int)(seq.size() * TRIM_MAX_ERROR_RATE));
+    int window = TRIM_END_PROXIMITY + (int)seq.size();
+    set->window = window > set->window ? window : set->window;
+}
+
+trim_set_t *load_trim_sequences(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        ERROR("cannot open trim sequences - %s: %s", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    trim_set_t *set = new trim_set_t;
+    set->window = 0;
+    std::string name;
+    std::string seq;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '>') {
+            if (!name.empty()) {
+                add_sequence(set, name, seq, path);
+            }
+            name = line + 1;
+            name = name.substr(0, name.find_first_of(" \t"));
+            seq.clear();
+        } else if (!name.empty()) {
+            for (char *c = line; *c; ++c) {
+                seq += (*c >= 'a' && *c <= 'z') ? *c - 'a' + 'A' : *c;
+            }
+        }
+    }
+    fclose(fp);
+    if (!name.empty()) {
+        add_sequence(set, name, seq, path);
+    }
+    if (set->names.empty()) {
+        ERROR("no sequences in %s", path);
+        exit(EXIT_FAILURE);
+    }
+
+    return set;
+}
+
+void free_trim_sequences(trim_set_t *set) {
+    delete set;
+}
+
+void find_trim(const trim_set_t *set, const char *seq, size_t len, size_t *front, size_t *rear) {
+    const size_t window = len < (size_t)set->window ? len : (size_t)set->window;
+
+    // the start in read order and the end reversed, both encoded once for every sequence
+    std::vector<uint8_t> f(window);
+    std::vector<uint8_t> r(window);
+    for (size_t i = 0; i < window; ++i) {
+        f[i] = myers_base_code(seq[i]);
+        r[i] = myers_base_code(seq[len - 1 - i]);
+    }
+
+    *front = 0;
+    *rear = 0;
+    for (size_t k = 0; k < set->names.size(); ++k) {
+        const size_t n = window < (size_t)(TRIM_END_PROXIMITY + set->front[k].len) ? window : TRIM_END_PROXIMITY + set->front[k].len;
+        size_t end = 0;
+        if (myers_search(&set->front[k], f.data(), n, &end) <= set->max_edits[k] && end > *front) {
+            *front = end;
+        }
+        if (myers_search(&set->rear[k], r.data(), n, &end) <= set->max_edits[k] && end > *rear) {
+            *rear = end;
+        }
+    }
+
+    // a read made of little more than adapter keeps its start trim
+    if (*front + *rear > len) {
+        *rear = len - *front;
+    }
+}
+
+int32_t trim_set_size(const trim_set_t *set) {
+    return set->names.size();
+}
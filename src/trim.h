@@ -0,0 +1,29 @@
+/* @file trim.h
+**
+** adapter and primer trimming of basecalled reads
+** @@
+******************************************************************************/
+
+#ifndef TRIM_H
+#define TRIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRIM_END_PROXIMITY 150     // bases past the sequence length searched at each read end
+#define TRIM_MAX_ERROR_RATE 0.15f  // edits allowed per base of a trim sequence
+
+typedef struct trim_set trim_set_t;
+
+/* load the adapter and primer sequences to trim from a FASTA file, each is at most MYERS_MAX_PATTERN bases */
+trim_set_t *load_trim_sequences(const char *path);
+
+void free_trim_sequences(trim_set_t *set);
+
+/* bases to cut off the start (front) and the end (rear) of seq: up to the end of the furthest sequence found near the
+   start, and from the start of the furthest reverse complement found near the end. both are 0 when nothing is found */
+void find_trim(const trim_set_t *set, const char *seq, size_t len, size_t *front, size_t *rear);
+
+int32_t trim_set_size(const trim_set_t *set);
+
+#endif
@@ -0,0 +1,275 @@
+/* @file tune_main.cpp
+**
+** slorado tune: short timed basecalling trials to pick -C, -c, -t and -r for a model and host
+** @@
+******************************************************************************/
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <openfish/openfish_error.h>
+
+#include "slorado.h"
+#include "profile.h"
+#include "misc.h"
+#include "error.h"
+
+static struct option long_options[] = {
+    {"device", required_argument, 0, 'x'},          //0 device [cpu]
+    {"output", required_argument, 0, 'o'},          //1 profile to write [slorado_profile.toml]
+    {"reads", required_argument, 0, 'n'},           //2 reads per trial [500]
+    {"verbose", required_argument, 0, 'v'},         //3 verbosity level [1]
+    {"help", no_argument, 0, 'h'},                  //4
+    {"chunk-sizes", required_argument, 0, 0},       //5 candidate -c values
+    {"gpu-batchsizes", required_argument, 0, 0},    //6 candidate -C values
+    {"threads", required_argument, 0, 0},           //7 candidate -t values
+    {"runners", required_argument, 0, 0},           //8 candidate -r values (CPU only)
+    {0, 0, 0, 0}};
+
+/* one dimension of the search space */
+typedef struct {
+    const char *name;
+    std::vector<int64_t> values;
+} tune_dim_t;
+
+static inline void print_help_msg(FILE *fp_help) {
+    fprintf(fp_help, "usage: slorado tune [model] [data]\n");
+    fprintf(fp_help, "positional arguments:\n");
+    fprintf(fp_help, "  model FILE                  the basecaller model to tune for.\n");
+    fprintf(fp_help, "  data FILE                   S/BLOW5 file with representative reads.\n");
+    fprintf(fp_help, "\nbasic options:\n");
+    fprintf(fp_help, "  -x DEVICE                   specify device\n");
+    fprintf(fp_help, "  -o FILE                     profile to write [slorado_profile.toml]\n");
+    fprintf(fp_help, "  -n INT                      reads basecalled per trial [500]\n");
+    fprintf(fp_help, "  -h                          shows help message and exits\n");
+    fprintf(fp_help, "  --verbose INT               verbosity level [%d]\n", (int)get_log_level());
+    fprintf(fp_help, "\nsearch space (comma separated lists):\n");
+    fprintf(fp_help, "  --chunk-sizes LIST          chunk sizes, rounded down to the model stride [4000,6000,8000,10000]\n");
+    fprintf(fp_help, "  --gpu-batchsizes LIST       gpu batch sizes [128,256,500,1000]\n");
+    fprintf(fp_help, "  --threads LIST              processing threads [quarter, half and all of the cores]\n");
+    fprintf(fp_help, "  --runners LIST              model runners, CPU only [1,2]\n");
+}
+
+static void parse_list(const char *arg, const char *name, std::vector<int64_t> &values) {
+    values.clear();
+    const char *p = arg;
+    while (*p) {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v < 1 || (*end != ',' && *end != '\0')) {
+            ERROR("Invalid value list for --%s: %s", name, arg);
+            exit(EXIT_FAILURE);
+        }
+        values.push_back(v);
+        p = *end == ',' ? end + 1 : end;
+    }
+    if (values.empty()) {
+        ERROR("Empty value list for --%s", name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void set_param(opt_t *opt, int dim, int64_t v) {
+    switch (dim) {
+        case 0: opt->chunk_size = v; break;
+        case 1: opt->gpu_batch_size = v; break;
+        case 2: opt->num_thread = v; break;
+        case 3: opt->num_runners = v; break;
+    }
+}
+
+static int same_params(const opt_t *a, const opt_t *b) {
+    return a->chunk_size == b->chunk_size && a->gpu_batch_size == b->gpu_batch_size && a->num_thread == b->num_thread && a->num_runners == b->num_runners;
+}
+
+static int valid_opt(const opt_t *opt) {
+    size_t max_input_tensor_len = 10000 * 6000; // same limit as the basecaller
+    return (size_t)opt->chunk_size * opt->gpu_batch_size <= max_input_tensor_len && (size_t)opt->overlap < opt->chunk_size;
+}
+
+/* basecall the first n_reads reads once to warm up, then again timed, returns samples per second */
+static double run_trial(char *data, char *model, opt_t opt) {
+    core_t *core = init_core(data, opt, model, realtime());
+    db_t *db = init_db(core);
+
+    // lazy allocations in torch, the runners' decode buffers and the chunk arena all happen on the first batch
+    ret_status_t status = load_db(core, db);
+    if (status.num_reads == 0) {
+        ERROR("No reads found in %s", data);
+        exit(EXIT_FAILURE);
+    }
+    process_db(core, db);
+    free_db_tmp(db);
+
+    // rewind so that every trial is timed on the same reads
+    slow5_close(core->sp);
+    core->sp = slow5_open(data, "r");
+    if (core->sp == NULL) {
+        ERROR("Error reopening SLOW5 file %s", data);
+        exit(EXIT_FAILURE);
+    }
+    load_db(core, db);
+
+    core->time_process_db = 0;
+    core->time_runners = 0;
+    for (size_t i = 0; i < core->runner_stats->size(); ++i) {
+        (*core->runner_stats)[i]->time_decode_wait = 0;
+    }
+    process_db(core, db);
+
+    uint64_t samples = 0;
+    for (int32_t i = 0; i < db->n_rec; ++i) {
+        samples += db->slow5_rec[i]->len_raw_signal;
+    }
+    double decode_wait = 0;
+    for (size_t i = 0; i < core->runner_stats->size(); ++i) {
+        decode_wait += (*core->runner_stats)[i]->time_decode_wait;
+    }
+    double samples_per_sec = samples / core->time_process_db;
+
+    fprintf(stderr, "[%s] -c %zu -C %d -t %d -r %d: %.0f samples/s (processing %.3f sec, runners %.3f sec, waiting on decode %.3f sec)\n", __func__,
+            opt.chunk_size, opt.gpu_batch_size, opt.num_thread, opt.num_runners, samples_per_sec, core->time_process_db, core->time_runners, decode_wait);
+
+    free_db_tmp(db);
+    free_db(db);
+    free_core(core, opt);
+
+    return samples_per_sec;
+}
+
+int tune_main(int argc, char* argv[]) {
+    const char* optstring = "x:o:n:v:h";
+
+    int longindex = 0;
+    int32_t c = -1;
+
+    FILE *fp_help = stderr;
+    const char *profile_path = "slorado_profile.toml";
+    int32_t n_reads = 500;
+
+    opt_t opt;
+    init_opt(&opt);
+
+    int ncores = sysconf(_SC_NPROCESSORS_ONLN);
+    ncores = ncores > 0 ? ncores : 1;
+
+    tune_dim_t dims[4] = {
+        {"chunk-sizes", {4000, 6000, 8000, 10000}},
+        {"gpu-batchsizes", {128, 256, 500, 1000}},
+        {"threads", {}},
+        {"runners", {1, 2}},
+    };
+    for (int t = std::max(1, ncores / 4); t <= ncores; t *= 2) {
+        dims[2].values.push_back(t);
+    }
+    if (dims[2].values.back() != ncores) {
+        dims[2].values.push_back(ncores);
+    }
+
+    while ((c = getopt_long(argc, argv, optstring, long_options, &longindex)) >= 0) {
+        if (c == 'x') {
+            opt.device = optarg;
+        } else if (c == 'o') {
+            profile_path = optarg;
+        } else if (c == 'n') {
+            n_reads = atoi(optarg);
+            if (n_reads < 1) {
+                ERROR("Number of reads should larger than 0. You entered %d", n_reads);
+                exit(EXIT_FAILURE);
+            }
+        } else if (c == 'v') {
+            int v = atoi(optarg);
+            set_log_level((enum log_level_opt)v);
+            set_openfish_log_level((enum openfish_log_level_opt)v);
+        } else if (c == 'h') {
+            fp_help = stdout;
+        } else if (c == 0 && longindex >= 5 && longindex <= 8) { // same order as dims
+            parse_list(optarg, long_options[longindex].name, dims[longindex - 5].values);
+        }
+    }
+
+    if (argc - optind != 2 || fp_help == stdout) {
+        print_help_msg(fp_help);
+        if (fp_help == stdout) {
+            exit(EXIT_SUCCESS);
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    char *model = argv[optind++];
+    char *data = argv[optind];
+
+    // chunk sizes the basecaller would round down anyway collapse into one candidate
+    CRFModelConfig model_config = is_tx_model_config(model) ? load_tx_model_config(model) : load_lstm_model_config(model);
+    const int64_t stride = model_config.stride;
+    std::vector<int64_t> &chunk_sizes = dims[0].values;
+    for (auto &v : chunk_sizes) {
+        v -= v % stride;
+    }
+    chunk_sizes.erase(std::remove_if(chunk_sizes.begin(), chunk_sizes.end(), [](int64_t v) { return v <= 0; }), chunk_sizes.end());
+    std::sort(chunk_sizes.begin(), chunk_sizes.end());
+    chunk_sizes.erase(std::unique(chunk_sizes.begin(), chunk_sizes.end()), chunk_sizes.end());
+    if (chunk_sizes.empty()) {
+        ERROR("No chunk size candidate is at least the model stride %ld", (long)stride);
+        exit(EXIT_FAILURE);
+    }
+
+    // GPU runners are one per device
+    if (strcmp(opt.device, "cpu") != 0) {
+        dims[3].values = {1};
+    }
+
+    opt.batch_size = n_reads;
+    opt.batch_size_bytes = INT64_MAX;
+
+    fprintf(stderr, "\nslorado tune version %s\n", SLORADO_VERSION);
+    fprintf(stderr, "model path:         %s\n", model);
+    fprintf(stderr, "input path:         %s\n", data);
+    fprintf(stderr, "profile path:       %s\n", profile_path);
+    fprintf(stderr, "device:             %s\n", opt.device);
+    fprintf(stderr, "reads per trial:    %d\n\n", n_reads);
+
+    // the full grid is too slow to time, so tune one parameter at a time keeping the best of the others
+    // chunk size first since it changes the per-chunk work the other parameters are balanced against
+    double best = -1;
+    opt_t best_opt = opt;
+    if (valid_opt(&opt)) {
+        best = run_trial(data, model, opt);
+    }
+    for (int dim = 0; dim < 4; ++dim) {
+        for (int64_t v : dims[dim].values) {
+            opt_t trial = best_opt;
+            set_param(&trial, dim, v);
+            if (!valid_opt(&trial)) {
+                LOG_DEBUG("skipping %s %ld, input tensor too large or chunk smaller than the overlap", dims[dim].name, (long)v);
+                continue;
+            }
+            if (best >= 0 && same_params(&trial, &best_opt)) { // already timed
+                continue;
+            }
+            double samples_per_sec = run_trial(data, model, trial);
+            if (samples_per_sec > best) {
+                best = samples_per_sec;
+                best_opt = trial;
+            }
+        }
+    }
+
+    if (best < 0) {
+        ERROR("%s", "No valid configuration in the search space");
+        exit(EXIT_FAILURE);
+    }
+
+    write_profile(profile_path, &best_opt, model, best);
+    fprintf(stderr, "\n[%s] best: -c %zu -C %d -t %d -r %d at %.0f samples/s, written to %s\n", __func__,
+            best_opt.chunk_size, best_opt.gpu_batch_size, best_opt.num_thread, best_opt.num_runners, best, profile_path);
+
+    return 0;
+}
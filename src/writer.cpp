@@ -33,25 +33,299 @@ SOFTWARE.
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <unistd.h>
 
+#include "writer.h"
+#include "zwriter.h"
+#include "slorado.h"
 #include "error.h"
 
-void write_to_file(FILE *out, char *sequence, char *qstring, char *read_id, bool emit_fastq) {
-    if (emit_fastq) {
-        int sequence_len = strlen(sequence);
-        int qstring_len = strlen(qstring);
-        if (sequence_len != qstring_len) {
-            ERROR("sequence len: %d != qstring len: %d", sequence_len, qstring_len);
-            exit(EXIT_FAILURE);
+#define BAM_FUNMAP 4
+#define BAM_UNMAPPED_BIN 4680 // reg2bin(-1, 0)
+
+struct writer {
+    int format;
+    FILE *fp;
+    int fd;                 // fp's descriptor, the buffer bypasses stdio
+    zwriter_t *z;           // NULL writes straight to fd
+
+    // records formatted since the last flush
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t flush_size;      // flush once this much is buffered
+    uint64_t bytes;         // flushed so far
+};
+
+int writer_format(const char *name) {
+    if (strcmp(name, "fastq") == 0) {
+        return WRITER_FASTQ;
+    } else if (strcmp(name, "sam") == 0) {
+        return WRITER_SAM;
+    } else if (strcmp(name, "bam") == 0) {
+        return WRITER_BAM;
+    }
+    return -1;
+}
+
+static void buf_reserve(writer_t *w, size_t n) {
+    if (w->len + n > w->cap) {
+        size_t cap = w->cap ? w->cap : 4096;
+        while (cap < w->len + n) {
+            cap *= 2;
         }
+        w->buf = (char *)realloc(w->buf, cap);
+        MALLOC_CHK(w->buf);
+        w->cap = cap;
+    }
+}
+
+static void buf_put(writer_t *w, const void *data, size_t n) {
+    buf_reserve(w, n);
+    memcpy(w->buf + w->len, data, n);
+    w->len += n;
+}
+
+static void buf_puts(writer_t *w, const char *s) {
+    buf_put(w, s, strlen(s));
+}
+
+static void buf_putc(writer_t *w, char c) {
+    buf_put(w, &c, 1);
+}
+
+static void buf_put_int(writer_t *w, int64_t v) {
+    char num[24];
+    int n = 0;
+    uint64_t u = v < 0 ? -(uint64_t)v : (uint64_t)v;
+    do {
+        num[sizeof(num) - 1 - n++] = '0' + u % 10;
+        u /= 10;
+    } while (u > 0);
+    if (v < 0) {
+        num[sizeof(num) - 1 - n++] = '-';
+    }
+    buf_put(w, num + sizeof(num) - n, n);
+}
+
+// BAM integers are little endian
+static void buf_put_le(writer_t *w, uint64_t v, int bytes) {
+    uint8_t b[8];
+    for (int i = 0; i < bytes; ++i) {
+        b[i] = (v >> (8 * i)) & 0xff;
+    }
+    buf_put(w, b, bytes);
+}
 
-        int expected_len_bytes = strlen(read_id) + sequence_len + qstring_len + 6;
-        int ret = fprintf(out, "@%s\n%s\n+\n%s\n", read_id, sequence, qstring);
-        if (ret != expected_len_bytes) {
-            ERROR("error writing fastq: %s", strerror(ret));
-            exit(EXIT_FAILURE);
+static void flush_buf(writer_t *w) {
+    if (w->z) {
+        zw_write(w->z, w->buf, w->len);
+    } else {
+        // one write per buffer, looping only for short writes to pipes
+        size_t done = 0;
+        while (done < w->len) {
+            ssize_t n = write(w->fd, w->buf + done, w->len - done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                ERROR("error writing output: %s", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            done += n;
         }
+    }
+    w->bytes += w->len;
+    w->len = 0;
+}
+
+uint64_t writer_bytes(const writer_t *w) {
+    return w->bytes + w->len;
+}
+
+void flush_writer(writer_t *w) {
+    if (w->len > 0) {
+        flush_buf(w);
+    }
+}
+
+static void format_header_text(writer_t *w, const char *cmdline) {
+    buf_puts(w, "@HD\tVN:1.6\tSO:unknown\n");
+    buf_puts(w, "@PG\tID:basecaller\tPN:slorado\tVN:" SLORADO_VERSION "\tCL:");
+    buf_puts(w, cmdline);
+    buf_putc(w, '\n');
+}
+
+static void write_header(writer_t *w, const char *cmdline) {
+    if (w->format == WRITER_SAM) {
+        format_header_text(w, cmdline);
+    } else if (w->format == WRITER_BAM) {
+        // the text is formatted first to learn its length, then moved behind the magic and l_text
+        format_header_text(w, cmdline);
+        size_t l_text = w->len;
+        buf_reserve(w, 8);
+        memmove(w->buf + 8, w->buf, l_text);
+        w->len = 0;
+        buf_put(w, "BAM\1", 4);
+        buf_put_le(w, l_text, 4);
+        w->len += l_text;
+        buf_put_le(w, 0, 4); // n_ref, the reads are unaligned
+    }
+    flush_buf(w);
+}
+
+writer_t *init_writer(FILE *fp, int format, int codec, int level, int compress_threads, zpool_t *pool, size_t buf_size, const char *cmdline) {
+    writer_t *w = (writer_t *)calloc(1, sizeof(writer_t));
+    MALLOC_CHK(w);
+    w->format = format;
+    w->fp = fp;
+    if (fflush(fp) != 0) { // nothing stdio buffered may land after the records
+        ERROR("error writing output: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    w->fd = fileno(fp);
+    w->flush_size = buf_size > 0 ? buf_size : WRITER_BUF_SIZE;
+    buf_reserve(w, w->flush_size);
+    if (format == WRITER_BAM) {
+        codec = ZW_BGZF;
+    }
+    if (codec != ZW_NONE) {
+        w->z = pool ? zw_open_pool(fp, pool, ZW_POOL_SLOTS) : zw_open(fp, codec, level, compress_threads);
+    }
+    write_header(w, cmdline);
+    return w;
+}
+
+/* the record is laid out with plain copies, the lengths are all known up front */
+static void format_fastq(writer_t *w, const read_out_t *r) {
+    const size_t id_len = strlen(r->read_id);
+    buf_reserve(w, id_len + 2 * r->len + 6);
+    char *p = w->buf + w->len;
+    *p++ = '@';
+    memcpy(p, r->read_id, id_len);
+    p += id_len;
+    *p++ = '\n';
+    memcpy(p, r->sequence, r->len);
+    p += r->len;
+    memcpy(p, "\n+\n", 3);
+    p += 3;
+    memcpy(p, r->qstring, r->len);
+    p += r->len;
+    *p++ = '\n';
+    w->len = p - w->buf;
+}
+
+static void format_sam(writer_t *w, const read_out_t *r) {
+    buf_puts(w, r->read_id);
+    buf_puts(w, "\t4\t*\t0\t0\t*\t*\t0\t0\t");
+    if (r->len > 0) {
+        buf_put(w, r->sequence, r->len);
+        buf_putc(w, '\t');
+        buf_put(w, r->qstring, r->len);
     } else {
-        // todo: samline outuput
+        buf_puts(w, "*\t*");
+    }
+    buf_puts(w, "\tts:i:");
+    buf_put_int(w, r->trimmed_samples);
+    if (r->barcode_name && r->barcode >= 0) {
+        buf_puts(w, "\tBC:Z:");
+        buf_puts(w, r->barcode_name);
+    }
+    if (r->moves) {
+        buf_puts(w, "\tmv:B:c,");
+        buf_put_int(w, r->stride);
+        buf_reserve(w, 2 * r->moves_len);
+        for (size_t i = 0; i < r->moves_len; ++i) {
+            w->buf[w->len++] = ',';
+            w->buf[w->len++] = '0' + r->moves[i];
+        }
+    }
+    buf_putc(w, '\n');
+}
+
+// 4-bit BAM base codes, anything unexpected becomes N
+static inline uint8_t seq_nt16(char c) {
+    switch (c) {
+        case 'A': return 1;
+        case 'C': return 2;
+        case 'G': return 4;
+        case 'T': case 'U': return 8;
+    }
+    return 15;
+}
+
+static void format_bam(writer_t *w, const read_out_t *r) {
+    const size_t l_read_name = strlen(r->read_id) + 1;
+    if (l_read_name > 255) {
+        ERROR("read id %s is too long for BAM", r->read_id);
+        exit(EXIT_FAILURE);
+    }
+
+    const size_t start = w->len;
+    buf_reserve(w, 36 + l_read_name + (r->len + 1) / 2 + r->len + 16 + r->moves_len);
+    buf_put_le(w, 0, 4);                    // block_size, filled in at the end
+    buf_put_le(w, (uint32_t)-1, 4);         // refID
+    buf_put_le(w, (uint32_t)-1, 4);         // pos
+    buf_put_le(w, l_read_name, 1);
+    buf_put_le(w, 0, 1);                    // mapq
+    buf_put_le(w, BAM_UNMAPPED_BIN, 2);
+    buf_put_le(w, 0, 2);                    // n_cigar_op
+    buf_put_le(w, BAM_FUNMAP, 2);
+    buf_put_le(w, r->len, 4);
+    buf_put_le(w, (uint32_t)-1, 4);         // next_refID
+    buf_put_le(w, (uint32_t)-1, 4);         // next_pos
+    buf_put_le(w, 0, 4);                    // tlen
+    buf_put(w, r->read_id, l_read_name);
+
+    uint8_t *seq = (uint8_t *)w->buf + w->len;
+    for (size_t i = 0; i < r->len; i += 2) {
+        uint8_t hi = seq_nt16(r->sequence[i]) << 4;
+        uint8_t lo = i + 1 < r->len ? seq_nt16(r->sequence[i + 1]) : 0;
+        seq[i / 2] = hi | lo;
+    }
+    w->len += (r->len + 1) / 2;
+
+    uint8_t *qual = (uint8_t *)w->buf + w->len;
+    for (size_t i = 0; i < r->len; ++i) {
+        qual[i] = r->qstring[i] - 33;
+    }
+    w->len += r->len;
+
+    buf_put(w, "tsi", 3);
+    buf_put_le(w, (uint32_t)(int32_t)r->trimmed_samples, 4);
+    if (r->barcode_name && r->barcode >= 0) {
+        buf_put(w, "BCZ", 3);
+        buf_put(w, r->barcode_name, strlen(r->barcode_name) + 1);
+    }
+    if (r->moves) {
+        buf_put(w, "mvBc", 4);
+        buf_put_le(w, r->moves_len + 1, 4);
+        buf_put_le(w, (uint8_t)r->stride, 1);
+        buf_put(w, r->moves, r->moves_len);
+    }
+
+    const uint32_t block_size = w->len - start - 4;
+    for (int i = 0; i < 4; ++i) {
+        w->buf[start + i] = (block_size >> (8 * i)) & 0xff;
+    }
+}
+
+void write_read(writer_t *w, const read_out_t *read) {
+    switch (w->format) {
+        case WRITER_FASTQ: format_fastq(w, read); break;
+        case WRITER_SAM: format_sam(w, read); break;
+        case WRITER_BAM: format_bam(w, read); break;
+    }
+    if (w->len >= w->flush_size) {
+        flush_buf(w);
+    }
+}
+
+void free_writer(writer_t *w) {
+    flush_writer(w);
+    if (w->z) {
+        zw_close(w->z);
     }
-}
\ No newline at end of file
+    free(w->buf);
+    free(w);
+}
@@ -7,6 +7,61 @@
 #ifndef WRITER_H
 #define WRITER_H
 
-void write_to_file(FILE *out, char *sequence, char *qstring, char *read_id, bool emit_fastq);
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#endif
\ No newline at end of file
+#include "zwriter.h"
+
+// output formats
+#define WRITER_FASTQ 0
+#define WRITER_SAM 1
+#define WRITER_BAM 2     // unaligned BAM, BGZF compressed
+
+#define WRITER_BUF_SIZE (4 * 1024 * 1024) // default bytes formatted before they are written out
+
+/* one basecalled read as handed to the writer */
+typedef struct {
+    const char *read_id;
+    const char *sequence;
+    const char *qstring;        // phred + 33
+    size_t len;
+    const uint8_t *moves;       // move table in signal order, NULL to leave out the mv tag
+    size_t moves_len;
+    int32_t stride;             // signal samples per move
+    int64_t trimmed_samples;    // samples trimmed off the start of the signal, the ts tag
+
+    // only used to route the read and for the summary
+    uint64_t num_samples;       // 0 for a read without signal, it is not written
+    double duration;            // seconds
+    float mean_qscore;
+    int32_t barcode;            // BARCODE_ index from demux.h
+    const char *barcode_name;   // NULL when not demultiplexing, written as the BC tag of classified reads
+    int32_t trimmed_front;      // adapter and primer bases already cut off the start of sequence
+    int32_t trimmed_rear;       // and off its end
+} read_out_t;
+
+typedef struct writer writer_t;
+
+/* write reads in format to fp, compressed with codec (a ZW_ codec, BAM is always BGZF) at level (-1 for the codec's
+   default) by compress_threads threads, or on pool when it is not NULL (made for the same codec and level),
+   cmdline goes into the @PG header line of SAM and BAM
+   records are formatted into one buffer and written out with a single write once buf_size bytes (0 for the default)
+   are buffered, fp must not be written through stdio while the writer is open */
+writer_t *init_writer(FILE *fp, int format, int codec, int level, int compress_threads, zpool_t *pool, size_t buf_size, const char *cmdline);
+
+void write_read(writer_t *w, const read_out_t *read);
+
+/* write out whatever is buffered */
+void flush_writer(writer_t *w);
+
+/* bytes written so far before compression, including what is still buffered */
+uint64_t writer_bytes(const writer_t *w);
+
+/* flush everything, fp is left open */
+void free_writer(writer_t *w);
+
+/* format from a name given to --output-format, -1 if unknown */
+int writer_format(const char *name);
+
+#endif
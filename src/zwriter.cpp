@@ -0,0 +1,404 @@
+/* @file zwriter.cpp
+**
+** block compressed output, blocks are compressed by a pool of threads and written in order
+** a pool can be shared by several files, each file keeps its own blocks and the thread finishing a block writes it out
+** @@
+******************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef SLORADO_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "zwriter.h"
+#include "error.h"
+
+#define BGZF_HEADER_SIZE 18
+#define BGZF_FOOTER_SIZE 8
+#define BGZF_MAX_BLOCK 0x10000
+
+// an empty BGZF block, marks the end of the file for htslib
+static const uint8_t bgzf_eof[28] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+    0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+// states of a block slot
+#define ZB_FREE 0       // the producer may fill it
+#define ZB_PENDING 1    // full, waiting for a compression thread
+#define ZB_DONE 2       // compressed, waiting to be written
+
+typedef struct zblock {
+    uint8_t *in;
+    size_t in_len;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+    int state;
+    zwriter_t *owner;
+    struct zblock *next;        // next pending block of the pool
+} zblock_t;
+
+struct zpool {
+    int codec;
+    int level;
+    size_t block_size;
+    size_t out_cap;
+
+    zblock_t *head;             // pending blocks of every file, in the order they were filled
+    zblock_t *tail;
+    int stopping;
+
+    pthread_t *workers;
+    int n_workers;
+    pthread_mutex_t lock;       // guards the queue and the blocks of every file on the pool
+    pthread_cond_t cond;        // broadcast on every state change, the queues are short
+};
+
+/* block k lives in slot k % n_slots, so blocks are written in the order they were filled */
+struct zwriter {
+    FILE *fp;
+    zpool_t *pool;
+    int own_pool;               // opened by zw_open, stopped by zw_close
+
+    zblock_t *slots;
+    int n_slots;
+    uint64_t next_fill;         // block the producer is filling
+    uint64_t next_write;        // next block to be written
+    int writing;                // a pool thread is writing this file's blocks
+};
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = v >> 24;
+}
+
+static size_t deflate_raw(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_cap, int level) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        ERROR("%s", "deflateInit2 failed");
+        exit(EXIT_FAILURE);
+    }
+    zs.next_in = (Bytef *)in;
+    zs.avail_in = in_len;
+    zs.next_out = out;
+    zs.avail_out = out_cap;
+    int ret = deflate(&zs, Z_FINISH);
+    size_t n = zs.total_out;
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END ? n : 0;
+}
+
+static void compress_bgzf(zblock_t *b, int level) {
+    uint8_t *out = b->out;
+    const size_t max_data = BGZF_MAX_BLOCK - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+    size_t n = deflate_raw(b->in, b->in_len, out + BGZF_HEADER_SIZE, max_data, level);
+    if (n == 0) { // incompressible data expanded past the block limit, store it
+        n = deflate_raw(b->in, b->in_len, out + BGZF_HEADER_SIZE, max_data, 0);
+        if (n == 0) {
+            ERROR("%s", "BGZF block does not fit in 64 KiB");
+            exit(EXIT_FAILURE);
+        }
+    }
+    const size_t block_len = BGZF_HEADER_SIZE + n + BGZF_FOOTER_SIZE;
+
+    static const uint8_t header[12] = {0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0x00};
+    memcpy(out, header, sizeof(header));
+    out[12] = 'B';
+    out[13] = 'C';
+    put_u16(out + 14, 2);
+    put_u16(out + 16, block_len - 1);
+
+    uint32_t crc = crc32(crc32(0L, Z_NULL, 0), b->in, b->in_len);
+    put_u32(out + BGZF_HEADER_SIZE + n, crc);
+    put_u32(out + BGZF_HEADER_SIZE + n + 4, b->in_len);
+    b->out_len = block_len;
+}
+
+#ifdef SLORADO_USE_ZSTD
+static void compress_zstd(zblock_t *b, int level, ZSTD_CCtx *cctx) {
+    size_t n = ZSTD_compressCCtx(cctx, b->out, b->out_cap, b->in, b->in_len, level);
+    if (ZSTD_isError(n)) {
+        ERROR("zstd compression failed: %s", ZSTD_getErrorName(n));
+        exit(EXIT_FAILURE);
+    }
+    b->out_len = n;
+}
+#endif
+
+/* ctx is the codec's per thread state, NULL for BGZF */
+static void compress_block(zpool_t *p, zblock_t *b, void *ctx) {
+    switch (p->codec) {
+        case ZW_BGZF: compress_bgzf(b, p->level); break;
+#ifdef SLORADO_USE_ZSTD
+        case ZW_ZSTD: compress_zstd(b, p->level, (ZSTD_CCtx *)ctx); break;
+#endif
+    }
+}
+
+/* write out the compressed blocks of z that are next in order, called with the pool lock held
+   one thread writes a file at a time, the others leave their finished blocks to it */
+static void write_done_blocks(zwriter_t *z) {
+    zpool_t *p = z->pool;
+    if (z->writing) {
+        return;
+    }
+    z->writing = 1;
+    for (;;) {
+        zblock_t *b = &z->slots[z->next_write % z->n_slots];
+        if (b->state != ZB_DONE) {
+            break;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        if (fwrite(b->out, 1, b->out_len, z->fp) != b->out_len) {
+            ERROR("error writing compressed output: %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        pthread_mutex_lock(&p->lock);
+        b->in_len = 0;
+        b->state = ZB_FREE;
+        z->next_write++;
+        pthread_cond_broadcast(&p->cond);
+    }
+    z->writing = 0;
+}
+
+static void *pthread_compress(void *voidargs) {
+    zpool_t *p = (zpool_t *)voidargs;
+    void *ctx = NULL;
+#ifdef SLORADO_USE_ZSTD
+    if (p->codec == ZW_ZSTD) {
+        ctx = ZSTD_createCCtx();
+        MALLOC_CHK(ctx);
+    }
+#endif
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->head == NULL && !p->stopping) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        if (p->head == NULL) { // stopping and nothing left
+            break;
+        }
+        zblock_t *b = p->head;
+        p->head = b->next;
+        if (p->head == NULL) {
+            p->tail = NULL;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        compress_block(p, b, ctx);
+
+        pthread_mutex_lock(&p->lock);
+        b->state = ZB_DONE;
+        write_done_blocks(b->owner);
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+#ifdef SLORADO_USE_ZSTD
+    ZSTD_freeCCtx((ZSTD_CCtx *)ctx);
+#endif
+    pthread_exit(0);
+}
+
+int zw_supported(int codec) {
+#ifdef SLORADO_USE_ZSTD
+    return codec == ZW_BGZF || codec == ZW_ZSTD;
+#else
+    return codec == ZW_BGZF;
+#endif
+}
+
+static int has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+int zw_codec_from_path(const char *path) {
+    if (has_suffix(path, ".gz") || has_suffix(path, ".bgz")) {
+        return ZW_BGZF;
+    } else if (has_suffix(path, ".zst")) {
+        return ZW_ZSTD;
+    }
+    return ZW_NONE;
+}
+
+void zw_strip_suffix(const char *path, char *buf, size_t n) {
+    snprintf(buf, n, "%s", path);
+    const char *suffixes[] = {".gz", ".bgz", ".zst"};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+        if (has_suffix(buf, suffixes[i])) {
+            buf[strlen(buf) - strlen(suffixes[i])] = '\0';
+            break;
+        }
+    }
+}
+
+zpool_t *zw_pool_create(int codec, int level, int threads) {
+    if (!zw_supported(codec)) {
+        ERROR("%s", "zstd output needs slorado built with zstd=1");
+        exit(EXIT_FAILURE);
+    }
+    zpool_t *p = (zpool_t *)calloc(1, sizeof(zpool_t));
+    MALLOC_CHK(p);
+    p->codec = codec;
+    p->level = level >= 0 ? level : (codec == ZW_ZSTD ? ZW_ZSTD_LEVEL : ZW_BGZF_LEVEL);
+    p->block_size = ZW_BGZF_BLOCK;
+    p->out_cap = BGZF_MAX_BLOCK;
+#ifdef SLORADO_USE_ZSTD
+    if (codec == ZW_ZSTD) {
+        p->block_size = ZW_ZSTD_BLOCK;
+        p->out_cap = ZSTD_compressBound(ZW_ZSTD_BLOCK);
+    }
+#endif
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+
+    p->n_workers = threads > 0 ? threads : 1;
+    p->workers = (pthread_t *)malloc(p->n_workers * sizeof(pthread_t));
+    MALLOC_CHK(p->workers);
+    for (int i = 0; i < p->n_workers; ++i) {
+        int ret = pthread_create(&p->workers[i], NULL, pthread_compress, (void *)p);
+        NEG_CHK(ret);
+    }
+    return p;
+}
+
+void zw_pool_free(zpool_t *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stopping = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+
+    for (int i = 0; i < p->n_workers; ++i) {
+        int ret = pthread_join(p->workers[i], NULL);
+        NEG_CHK(ret);
+    }
+    free(p->workers);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+    free(p);
+}
+
+zwriter_t *zw_open_pool(FILE *fp, zpool_t *pool, int slots) {
+    zwriter_t *z = (zwriter_t *)calloc(1, sizeof(zwriter_t));
+    MALLOC_CHK(z);
+    z->fp = fp;
+    z->pool = pool;
+    z->n_slots = slots > 2 ? slots : 2; // one filling while the other is compressed
+    z->slots = (zblock_t *)calloc(z->n_slots, sizeof(zblock_t));
+    MALLOC_CHK(z->slots);
+    for (int i = 0; i < z->n_slots; ++i) {
+        z->slots[i].in = (uint8_t *)malloc(pool->block_size);
+        MALLOC_CHK(z->slots[i].in);
+        z->slots[i].out = (uint8_t *)malloc(pool->out_cap);
+        MALLOC_CHK(z->slots[i].out);
+        z->slots[i].out_cap = pool->out_cap;
+        z->slots[i].state = ZB_FREE;
+        z->slots[i].owner = z;
+    }
+    return z;
+}
+
+zwriter_t *zw_open(FILE *fp, int codec, int level, int threads) {
+    zpool_t *pool = zw_pool_create(codec, level, threads);
+    // enough blocks in flight to keep every thread busy while the file is written
+    zwriter_t *z = zw_open_pool(fp, pool, 2 * pool->n_workers + 2);
+    z->own_pool = 1;
+    return z;
+}
+
+/* queue the block being filled for the compression threads */
+static void submit_block(zwriter_t *z) {
+    zpool_t *p = z->pool;
+    pthread_mutex_lock(&p->lock);
+    zblock_t *b = &z->slots[z->next_fill % z->n_slots];
+    b->state = ZB_PENDING;
+    b->next = NULL;
+    if (p->tail) {
+        p->tail->next = b;
+    } else {
+        p->head = b;
+    }
+    p->tail = b;
+    z->next_fill++;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* the block the producer fills next, waits for the writer when every slot is in flight */
+static zblock_t *fill_block(zwriter_t *z) {
+    zpool_t *p = z->pool;
+    zblock_t *b = &z->slots[z->next_fill % z->n_slots];
+    pthread_mutex_lock(&p->lock);
+    while (b->state != ZB_FREE) {
+        pthread_cond_wait(&p->cond, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return b;
+}
+
+void zw_write(zwriter_t *z, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (len > 0) {
+        zblock_t *b = fill_block(z);
+        size_t n = z->pool->block_size - b->in_len;
+        n = n < len ? n : len;
+        memcpy(b->in + b->in_len, p, n);
+        b->in_len += n;
+        p += n;
+        len -= n;
+        if (b->in_len == z->pool->block_size) {
+            submit_block(z);
+        }
+    }
+}
+
+void zw_close(zwriter_t *z) {
+    zblock_t *b = fill_block(z);
+    if (b->in_len > 0) {
+        submit_block(z);
+    }
+
+    zpool_t *p = z->pool;
+    pthread_mutex_lock(&p->lock);
+    while (z->next_write != z->next_fill) {
+        pthread_cond_wait(&p->cond, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    if (p->codec == ZW_BGZF && fwrite(bgzf_eof, 1, sizeof(bgzf_eof), z->fp) != sizeof(bgzf_eof)) {
+        ERROR("error writing compressed output: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (fflush(z->fp) != 0) {
+        ERROR("error writing compressed output: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < z->n_slots; ++i) {
+        free(z->slots[i].in);
+        free(z->slots[i].out);
+    }
+    free(z->slots);
+    if (z->own_pool) {
+        zw_pool_free(p);
+    }
+    free(z);
+}
@@ -0,0 +1,59 @@
+/* @file zwriter.h
+**
+** block compressed output, blocks are compressed by a pool of threads and written in order
+** @@
+******************************************************************************/
+
+#ifndef ZWRITER_H
+#define ZWRITER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// codecs
+#define ZW_NONE -1  // not compressed, only used by callers to say so
+#define ZW_BGZF 0   // gzip members with the BGZF extra field, readable by gzip, zcat and htslib
+#define ZW_ZSTD 1   // one zstd frame per block, readable by zstd and zstdcat (needs make zstd=1)
+
+#define ZW_BGZF_BLOCK 0xff00 // uncompressed bytes per BGZF block, the compressed block must fit in 64 KiB
+#define ZW_ZSTD_BLOCK (4 << 20) // uncompressed bytes per zstd frame, large frames compress better
+
+#define ZW_POOL_SLOTS 2 // blocks in flight per file on a shared pool, the pool's threads spread over the files
+
+#define ZW_BGZF_LEVEL 6 // default levels
+#define ZW_ZSTD_LEVEL 3
+
+typedef struct zwriter zwriter_t;
+typedef struct zpool zpool_t;
+
+/* start compressing into fp with threads compression threads of its own, level is the codec's compression level
+   (-1 for the default) */
+zwriter_t *zw_open(FILE *fp, int codec, int level, int threads);
+
+/* threads compression threads that files opened with zw_open_pool share */
+zpool_t *zw_pool_create(int codec, int level, int threads);
+
+/* stop the threads, every file on the pool must be closed */
+void zw_pool_free(zpool_t *p);
+
+/* start compressing into fp on pool, with at most slots blocks (at least 2) of this file in flight */
+zwriter_t *zw_open_pool(FILE *fp, zpool_t *pool, int slots);
+
+/* whether this build can write codec */
+int zw_supported(int codec);
+
+/* the codec a file name asks for from its suffix (.gz, .bgz, .zst), ZW_NONE otherwise */
+int zw_codec_from_path(const char *path);
+
+/* path without a compression suffix, into buf of size n */
+void zw_strip_suffix(const char *path, char *buf, size_t n);
+
+/* append len bytes, returns once they are copied */
+void zw_write(zwriter_t *z, const void *data, size_t len);
+
+/* compress and write what is buffered and write the end of file marker, fp is left open
+   a writer from zw_open also stops its threads */
+void zw_close(zwriter_t *z);
+
+#endif
@@ -1,6 +1,7 @@
 #!/bin/bash
 
 FAST="dna_r10.4.1_e8.2_400bps_fast@v4.2.0"
+SUP="dna_r10.4.1_e8.2_400bps_sup@v5.0.0" # transformer
 
 # terminate script
 die() {
@@ -77,4 +78,109 @@ ex  ./slorado basecaller models/$FAST test/5khz_r10/one_5khz.blow5 -c 1000 -C 1
 minimap2/minimap2 -cx map-ont test/chr3_34011000_34012000.fa test/tmp.fastq --secondary=no > test/tmp.paf || die "minimap2 failed"
 check_accuracy $(awk '{print $10/$11}' test/tmp.paf | datamash median 1)
 
+# the transformer model on the CPU runner: rotary embedding, window attention, gated MLP and deepnorm kernels
+test -d models/$SUP || download_model $SUP
+ex  ./slorado basecaller models/$SUP test/5khz_r10/one_5khz.blow5 -x cpu -v 6 > test/tmp_sup.fastq  || die "Running the transformer model on the CPU failed"
+minimap2/minimap2 -cx map-ont test/chr3_34011000_34012000.fa test/tmp_sup.fastq --secondary=no > test/tmp_sup.paf || die "minimap2 failed"
+check_accuracy $(awk '{print $10/$11}' test/tmp_sup.paf | datamash median 1)
+
+# output tests, every run basecalls the same reads in batches of 3 so each output must hold the reads of the plain FASTQ
+command -v samtools > /dev/null || die "samtools is needed for the output tests"
+READS=test/4khz_r10/10_reads.blow5
+OUT=test/tmp_out
+rm -rf $OUT && mkdir $OUT || die "Creating $OUT failed"
+
+basecall() {
+    ex ./slorado basecaller models/$FAST $READS -c 1000 -C 16 -K 3 --device $DEVICE "$@"
+}
+
+# read ids of a FASTQ on stdin, sorted
+fastq_ids() {
+    awk 'NR%4==1 {print substr($1, 2)}' | sort
+}
+
+# every SAM record on stdin has an mv tag whose moves (after the stride) add up to the length of SEQ
+check_moves() {
+    awk -F'\t' '!/^@/ {
+        n++; mv = 0
+        for (i = 12; i <= NF; i++) if (substr($i, 1, 7) == "mv:B:c,") mv = i
+        if (mv == 0) { print "no mv tag on " $1; bad++; next }
+        k = split(substr($mv, 8), m, ",")
+        sum = 0
+        for (j = 2; j <= k; j++) sum += m[j]
+        len = $10 == "*" ? 0 : length($10)
+        if (sum != len) { print $1 ": " sum " moves for " len " bases"; bad++ }
+    } END { if (n == 0 || bad > 0) exit 1 }' || die "$1: the move table does not match the sequence"
+}
+
+basecall -o $OUT/plain.fastq || die "Basecalling to FASTQ failed"
+fastq_ids < $OUT/plain.fastq > $OUT/plain.ids
+test $(wc -l < $OUT/plain.ids) -eq 10 || die "Expected 10 reads in $OUT/plain.fastq"
+
+# SAM and BAM: valid for samtools, the same reads and sequences as the FASTQ, and a move per base
+awk 'NR%4==1 {id = substr($1, 2)} NR%4==2 {print id "\t" $0}' $OUT/plain.fastq | sort > $OUT/plain.seqs
+basecall -o $OUT/reads.sam || die "Basecalling to SAM failed"
+basecall -o $OUT/reads.bam || die "Basecalling to BAM failed"
+for f in $OUT/reads.sam $OUT/reads.bam; do
+    samtools quickcheck $f || die "samtools quickcheck failed on $f"
+    samtools view $f > $OUT/records.sam || die "samtools view failed on $f"
+    check_moves $f < $OUT/records.sam
+    cut -f 1,10 $OUT/records.sam | sort | diff -q - $OUT/plain.seqs || die "$f does not hold the reads of the FASTQ"
+done
+
+# compressed FASTQ decompresses to the plain output
+basecall -o $OUT/reads.fastq.gz || die "Basecalling to .fastq.gz failed"
+zcat $OUT/reads.fastq.gz | diff -q - $OUT/plain.fastq || die "reads.fastq.gz differs from the plain FASTQ"
+if basecall -o $OUT/reads.fastq.zst 2> $OUT/zst.log; then
+    zstdcat $OUT/reads.fastq.zst | diff -q - $OUT/plain.fastq || die "reads.fastq.zst differs from the plain FASTQ"
+elif grep -q "built without zstd" $OUT/zst.log; then
+    echo "slorado was built without zstd, skipping the .zst test"
+else
+    cat $OUT/zst.log >&2
+    die "Basecalling to .fastq.zst failed"
+fi
+
+# shards: the manifest counts every read, and the shards hold each read exactly once
+basecall --out-shards 3 -o $OUT/shards || die "Basecalling to shards failed"
+test -e $OUT/shards/manifest.tsv || die "No shard manifest"
+test $(awk 'NR > 1 {n += $4} END {print n}' $OUT/shards/manifest.tsv) -eq 10 || die "The shard manifest does not count 10 reads"
+awk -v dir=$OUT/shards 'NR > 1 {print dir "/" $2}' $OUT/shards/manifest.tsv | xargs cat | fastq_ids | diff -q - $OUT/plain.ids || die "The shards do not hold each read once"
+
+# rotation: only complete segments, each with its .done marker, together holding each read exactly once
+basecall --rotate-output 2 -o $OUT/rot.fastq.gz || die "Basecalling with --rotate-output failed"
+ls $OUT/rot.*.part > /dev/null 2>&1 && die "Rotated segments were left as .part"
+for f in $OUT/rot.*.fastq.gz; do
+    test -e $f.done || die "$f has no .done marker"
+done
+zcat $OUT/rot.*.fastq.gz | fastq_ids | diff -q - $OUT/plain.ids || die "The rotated segments do not hold each read once"
+
+# rotated shards: the manifest lists every completed segment under the name it has on disk
+basecall --out-shards 2 --rotate-output 2 --output-format fastq -o $OUT/rot_shards || die "Basecalling to rotated shards failed"
+test $(awk 'NR > 1 {n += $4} END {print n}' $OUT/rot_shards/manifest.tsv) -eq 10 || die "The rotated shard manifest does not count 10 reads"
+for f in $(awk -v dir=$OUT/rot_shards 'NR > 1 {print dir "/" $2}' $OUT/rot_shards/manifest.tsv); do
+    test -e $f -a -e $f.done || die "$f in the manifest is not a completed segment"
+done
+awk -v dir=$OUT/rot_shards 'NR > 1 {print dir "/" $2}' $OUT/rot_shards/manifest.tsv | xargs cat | fastq_ids | diff -q - $OUT/plain.ids || die "The rotated shards do not hold each read once"
+
+# demultiplexing: every read lands in exactly one barcode file or the unclassified one
+# BC01 and its flanks are cut from the start of the first read, so at least that read has to be classified
+FIRST_ID=$(head -1 $OUT/plain.ids)
+FIRST_SEQ=$(awk -v id=$FIRST_ID 'NR%4==1 {keep = substr($1, 2) == id} NR%4==2 && keep {print}' $OUT/plain.fastq)
+printf '[arrangement]\nname = "test_kit"\nmask1_front = "%s"\nmask1_rear = "%s"\nbarcode1_pattern = "BC%%02i"\nfirst_index = 1\nlast_index = 2\n' ${FIRST_SEQ:10:8} ${FIRST_SEQ:42:8} > $OUT/kit.toml
+printf '>BC01\n%s\n>BC02\nACAGACGACTACAAACGGAATCGA\n' ${FIRST_SEQ:18:24} > $OUT/barcodes.fasta
+basecall --barcode-arrangement $OUT/kit.toml --barcode-sequences $OUT/barcodes.fasta --summary $OUT/demux.tsv -o $OUT/demux.fastq || die "Demultiplexing failed"
+cat $OUT/demux.*.fastq | fastq_ids | diff -q - $OUT/plain.ids || die "The barcode files do not hold each read once"
+test -e $OUT/demux.BC01.fastq || die "No read was classified as BC01"
+fastq_ids < $OUT/demux.BC01.fastq | grep -qx "$FIRST_ID" || die "$FIRST_ID carries BC01 but is not in demux.BC01.fastq"
+test "$(head -1 $OUT/demux.tsv | cut -f 8)" = "barcode" || die "The summary has no barcode column"
+
+# trimming: trimmed and kept bases add up to the plain read, and the move table still matches the sequence
+# the adapter is cut from near the start of the first read, so at least that read has to lose its front
+printf '>adapter\nTTTTTTTTCCTGTACTTCGTTCAGTTACGTATTGCT\n>first_read\n%s\n' ${FIRST_SEQ:5:30} > $OUT/adapters.fasta
+basecall --trim-sequences $OUT/adapters.fasta --summary $OUT/trim.tsv -o $OUT/trim.sam || die "Trimming failed"
+check_moves trim.sam < $OUT/trim.sam
+awk -F'\t' 'NR > 1 {print $1 "\t" $6 + $8 + $9}' $OUT/trim.tsv | sort > $OUT/trim.lens
+awk 'NR%4==1 {id = substr($1, 2)} NR%4==2 {print id "\t" length($0)}' $OUT/plain.fastq | sort | diff -q - $OUT/trim.lens || die "Trimmed lengths do not add up to the untrimmed reads"
+awk -F'\t' -v id=$FIRST_ID '$1 == id && $8 >= 35 {found = 1} END {exit !found}' $OUT/trim.tsv || die "$FIRST_ID was not trimmed past the adapter cut from it"
+
 echo "Tests passed"
@@ -2,6 +2,7 @@
 #include <string>
 
 #include "CRFModel.h"
+#include "cpu_kernels.h"
 #include "error.h"
 #include "tensor_chunk_utils.h"
 
@@ -18,9 +19,52 @@ ConvStackImpl::ConvStackImpl(const std::vector<ConvParams> &layer_params) {
     }
 }
 
+// The first layer sees the raw single channel signal, which the generic convolution handles poorly on the CPU.
+static bool use_single_channel_conv(const ConvStackImpl::ConvLayer &layer, const torch::Tensor &x) {
+    const ConvParams &params = layer.params;
+    return x.device().is_cpu() &&
+        x.scalar_type() == torch::kFloat32 &&
+        layer.conv->weight.scalar_type() == torch::kFloat32 &&
+        params.insize == 1 &&
+        params.stride == 1 &&
+        params.winlen <= CONV1_MAX_WINLEN &&
+        (params.activation == Activation::SWISH || params.activation == Activation::SWISH_CLAMP);
+}
+
+static torch::Tensor single_channel_conv(ConvStackImpl::ConvLayer &layer, const torch::Tensor &x) {
+    const int64_t N = x.size(0);
+    const int64_t T = x.size(2);
+    const int C = layer.params.size;
+    const int winlen = layer.params.winlen;
+    const int64_t T_out = T + 2 * (winlen / 2) - winlen + 1;
+    const bool clamp = layer.params.activation == Activation::SWISH_CLAMP;
+
+    const torch::Tensor in = x.contiguous();
+    const torch::Tensor weight = layer.conv->weight.contiguous();
+    const torch::Tensor bias = layer.conv->bias.contiguous();
+    torch::Tensor out = torch::empty({N, C, T_out}, x.options());
+
+    const float *in_ptr = in.data_ptr<float>();
+    const float *weight_ptr = weight.data_ptr<float>();
+    const float *bias_ptr = bias.data_ptr<float>();
+    float *out_ptr = out.data_ptr<float>();
+
+    at::parallel_for(0, N, 1, [&](int64_t begin, int64_t end) {
+        conv1d_single_channel_cpu(in_ptr, weight_ptr, bias_ptr, out_ptr, begin, end, T, C, winlen, clamp);
+    });
+
+    return out;
+}
+
 torch::Tensor ConvStackImpl::forward(torch::Tensor x) {
     // Input x is [N, C_in, T_in], contiguity optional
-    for (auto &layer : layers) {
+    for (size_t i = 0; i < layers.size(); ++i) {
+        auto &layer = layers[i];
+        if (i == 0 && use_single_channel_conv(layer, x)) {
+            // activation is fused into the kernel
+            x = single_channel_conv(layer, x);
+            continue;
+        }
         x = layer.conv(x);
         if (layer.params.activation == Activation::SWISH) {
             torch::silu_(x);
@@ -36,6 +80,14 @@ torch::Tensor ConvStackImpl::forward(torch::Tensor x) {
     return x.transpose(1, 2);
 }
 
+int64_t ConvStackImpl::output_length(int64_t T) const {
+    for (const auto &layer : layers) {
+        const int winlen = layer.params.winlen;
+        T = (T + 2 * (winlen / 2) - winlen) / layer.params.stride + 1;
+    }
+    return T;
+}
+
 ConvStackImpl::ConvLayer::ConvLayer(const ConvParams &conv_params) : params(conv_params) {}
 
 LinearCRFImpl::LinearCRFImpl(int insize, int outsize, bool bias_, bool tanh_and_scale) : bias(bias_) {
@@ -47,7 +99,7 @@ LinearCRFImpl::LinearCRFImpl(int insize, int outsize, bool bias_, bool tanh_and_
 
 torch::Tensor LinearCRFImpl::forward(const torch::Tensor &x) {
     // Input x is [N, T, C], contiguity optional
-    auto scores = linear(x);
+    auto scores = packed_linear(packed, linear, x);
     if (activation) {
         scores = activation(scores) * scale;
     }
@@ -114,6 +166,15 @@ void CRFModelImpl::load_state_dict(const std::vector<torch::Tensor> &weights) {
     module_load_state_dict(*this, weights);
 }
 
+// The LSTM layers are left alone, at::lstm runs its gate GEMMs inside the fused kernel with no packed entry point.
+void CRFModelImpl::prepack_weights(int64_t batch_size, int64_t chunk_size) {
+    const int64_t rows = batch_size * convs->output_length(chunk_size);
+    prepack_linear(linear1->packed, linear1->linear, rows);
+    if (linear2) {
+        prepack_linear(linear2->packed, linear2->linear, rows);
+    }
+}
+
 torch::Tensor CRFModelImpl::forward(const torch::Tensor &x) {
     // Output is [N, T, C]
     return encoder->forward(x);
@@ -158,12 +219,21 @@ std::vector<torch::Tensor> load_lstm_model_weights(const std::string &dir,
     return load_tensors(dir, tensors);
 }
 
-ModuleHolder<AnyModule> load_lstm_model(const CRFModelConfig &model_config, const torch::TensorOptions &options) {
+ModuleHolder<AnyModule> load_lstm_model(const CRFModelConfig &model_config, const torch::TensorOptions &options, bool share_weights, int64_t batch_size, int64_t chunk_size) {
     auto model = CRFModel(model_config);
     auto state_dict = load_lstm_model_weights(model_config.model_path, model_config.has_out_features, model_config.bias);
-    model->load_state_dict(state_dict);
+    const bool shared = share_weights && can_share_weights(model_config.model_path, state_dict, options);
+    if (shared) {
+        module_share_state_dict(*model, state_dict);
+    } else {
+        model->load_state_dict(state_dict);
+    }
     model->to(options.dtype().toScalarType());
     model->to(options.device());
+    // packed copies are private to the runner, which is what shared weights avoid
+    if (!shared && options.device().is_cpu()) {
+        model->prepack_weights(batch_size, chunk_size);
+    }
     model->eval();
 
     auto module = AnyModule(model);
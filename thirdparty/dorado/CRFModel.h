@@ -6,16 +6,21 @@
 #include <vector>
 
 #include "model_config.h"
+#include "tensor_chunk_utils.h"
 
 using namespace torch::nn;
 
-ModuleHolder<AnyModule> load_lstm_model(const CRFModelConfig &model_config, const torch::TensorOptions &options);
+// batch_size and chunk_size give the GEMM shapes CPU weights are prepacked for
+ModuleHolder<AnyModule> load_lstm_model(const CRFModelConfig &model_config, const torch::TensorOptions &options, bool share_weights, int64_t batch_size, int64_t chunk_size);
 
 struct ConvStackImpl : torch::nn::Module {
     explicit ConvStackImpl(const std::vector<ConvParams> &layer_params);
 
     torch::Tensor forward(torch::Tensor x);
 
+    // number of output time steps for an input of T samples
+    int64_t output_length(int64_t T) const;
+
     struct ConvLayer {
         explicit ConvLayer(const ConvParams &params);
         const ConvParams params;
@@ -30,6 +35,7 @@ struct LinearCRFImpl : torch::nn::Module {
     torch::Tensor forward(const torch::Tensor &x);
 
     bool bias;
+    PackedLinearWeight packed;
     static constexpr int scale = 5;
     torch::nn::Linear linear{nullptr};
     torch::nn::Tanh activation{nullptr};
@@ -57,6 +63,7 @@ TORCH_MODULE(Clamp);
 struct CRFModelImpl : torch::nn::Module {
     explicit CRFModelImpl(const CRFModelConfig &config);
     void load_state_dict(const std::vector<torch::Tensor> &weights);
+    void prepack_weights(int64_t batch_size, int64_t chunk_size);
 
     torch::Tensor forward(const torch::Tensor &x);
     ConvStack convs{nullptr};
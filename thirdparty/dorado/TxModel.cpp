@@ -1,12 +1,15 @@
 #include "TxModel.h"
+#include "cpu_kernels.h"
 
 #include <ATen/Functions.h>
+#include <ATen/Parallel.h>
 #include <ATen/TensorIndexing.h>
 #include <c10/core/ScalarType.h>
 #include <torch/nn/functional/padding.h>
 #include <torch/nn/options/padding.h>
 #include <torch/types.h>
 #include <torch/version.h>
+#include <c10/core/DeviceGuard.h>
 
 #include <cmath>
 #include <ATen/ops/scaled_dot_product_attention.h>
@@ -25,6 +28,17 @@
 using namespace torch::nn;
 using Slice = torch::indexing::Slice;
 
+// per-stage timings need the device to be idle, only GPU devices run asynchronously
+static inline void synchronize(const torch::Device &device) {
+#ifdef USE_GPU
+    if (device.is_cuda()) {
+        torch::cuda::synchronize(device.index());
+    }
+#else
+    (void)device;
+#endif
+}
+
 void apply_rounding(torch::Tensor &t, int remove_bits) {
     // Round Float16 tensor elements such that the last `remove_bits` of the mantissa are 0s.
     // TODO: this is slightly dangerous as it will turn numbers close to +/-65304 into +/-inf
@@ -67,7 +81,55 @@ GatedMLPImpl::GatedMLPImpl(int in_features_, int hidden_features_) : in_features
     fc2 = register_module("fc2", Linear(LinearOptions(hidden_features, in_features).bias(false)));
 };
 
+// fc1, the silu gating and fc2 are run tile by tile so the [N, T, 2 * hidden] intermediate never exists
+torch::Tensor GatedMLPImpl::forward_fused_cpu(const torch::Tensor &x) {
+    const int64_t M = x.numel() / in_features;
+    const torch::Tensor x2d = x.reshape({M, in_features}).contiguous();
+    const torch::Tensor w1 = fc1->weight.t();
+    const torch::Tensor w2 = fc2->weight.t();
+    torch::Tensor out = torch::empty({M, in_features}, x.options());
+
+    const int64_t n_tiles = div_round_up(M, int64_t{GATED_MLP_TILE});
+    at::parallel_for(0, n_tiles, 1, [&](int64_t begin, int64_t end) {
+        // inference mode is thread local and the pool threads do not inherit it
+        c10::InferenceMode guard;
+        // mkl::_mkl_linear has no out= form, packed tiles get fresh GEMM results and only the unpacked ones use h.
+        // a packed fc2 still costs one copy into out, which is cheaper than sgemm repacking w2 for every tile
+        torch::Tensor h;
+        torch::Tensor g = torch::empty({GATED_MLP_TILE, hidden_features}, x.options());
+        for (int64_t tile = begin; tile < end; ++tile) {
+            const int64_t r0 = tile * GATED_MLP_TILE;
+            const int64_t rows = std::min<int64_t>(GATED_MLP_TILE, M - r0);
+            torch::Tensor g_tile = g.narrow(0, 0, rows);
+            torch::Tensor out_tile = out.narrow(0, r0, rows);
+
+            torch::Tensor h_tile;
+            if (rows == fc1_packed.rows) {
+                h_tile = packed_linear(fc1_packed, fc1, x2d.narrow(0, r0, rows));
+            } else {
+                if (!h.defined()) {
+                    h = torch::empty({GATED_MLP_TILE, 2 * hidden_features}, x.options());
+                }
+                h_tile = h.narrow(0, 0, rows);
+                torch::mm_out(h_tile, x2d.narrow(0, r0, rows), w1);
+            }
+            gated_silu_cpu(h_tile.data_ptr<float>(), g_tile.data_ptr<float>(), rows, hidden_features);
+            if (rows == fc2_packed.rows) {
+                out_tile.copy_(packed_linear(fc2_packed, fc2, g_tile));
+            } else {
+                torch::mm_out(out_tile, g_tile, w2);
+            }
+        }
+    });
+
+    return out.view(x.sizes());
+}
+
 torch::Tensor GatedMLPImpl::forward(const torch::Tensor &x) {
+    if (x.device().is_cpu() && x.scalar_type() == torch::kFloat32 && !features_interleaved) {
+        return forward_fused_cpu(x);
+    }
+
     torch::Tensor t;
     t = fc1(x);
     const auto chunks = t.chunk(2, -1);
@@ -109,6 +171,24 @@ torch::Tensor RotaryEmbeddingImpl::forward(torch::Tensor &qkv) {
     const int stride_seq = qkv.stride(1);
     const int stride_head = qkv.stride(3);
 
+    if (qkv.device().is_cpu()) {
+        if (qkv.scalar_type() != torch::kFloat32) {
+            ERROR("RotE - CPU rotary embedding expects float32, found: %s", c10::toString(qkv.scalar_type()));
+            exit(EXIT_FAILURE);
+        }
+        float *q_ptr = qkv.select(2, 0).data_ptr<float>();
+        float *k_ptr = qkv.select(2, 1).data_ptr<float>();
+        const float *sin_ptr = sin_buf.data_ptr<float>();
+        const float *cos_ptr = cos_buf.data_ptr<float>();
+        const int rotary_half = sin_buf.size(1);
+
+        at::parallel_for(0, (int64_t)batch_size * seqlen, 64, [&](int64_t begin, int64_t end) {
+            rotary_emb_cpu(q_ptr, sin_ptr, cos_ptr, begin, end, seqlen, nheads, rotary_half, stride_batch, stride_seq, stride_head);
+            rotary_emb_cpu(k_ptr, sin_ptr, cos_ptr, begin, end, seqlen, nheads, rotary_half, stride_batch, stride_seq, stride_head);
+        });
+        return qkv;
+    }
+
     auto qkv_chunks = qkv.chunk(3, 2);
     
     openfish_rotary_emb_gpu(
@@ -209,23 +289,33 @@ torch::Tensor MultiHeadAttentionImpl::build_attn_window_mask(const int64_t size)
     return mask;
 };
 
+// The banded kernel only visits the keys admitted by the window and never builds the T x T mask.
+static bool use_window_attention_cpu(const torch::Tensor &qkv) {
+    const int64_t head_dim = qkv.size(4);
+    return qkv.device().is_cpu() &&
+        qkv.scalar_type() == torch::kFloat32 &&
+        qkv.stride(4) == 1 &&
+        head_dim % 4 == 0 &&
+        head_dim <= ATTN_MAX_HEAD_DIM;
+}
+
 torch::Tensor MultiHeadAttentionImpl::forward(torch::Tensor x) {
     const int64_t N = x.size(0);
     const int64_t T = x.size(1);
     const int64_t C = x.size(2);
 
     double a, b;
-    auto device_idx = options.device_index();
+    const auto device = options.device();
     
     a = realtime();
-    auto qkv = wqkv(x).view({N, T, 3, nhead, head_dim});
-    torch::cuda::synchronize(device_idx);
+    auto qkv = packed_linear(wqkv_packed, wqkv, x).view({N, T, 3, nhead, head_dim});
+    synchronize(device);
     b = realtime();
     model_stats->time_mm += b-a;
 
     a = realtime();
     qkv = rotary_emb(qkv);
-    torch::cuda::synchronize(device_idx);
+    synchronize(device);
     b = realtime();
     model_stats->time_rotary_emb += b-a;
 
@@ -235,7 +325,7 @@ torch::Tensor MultiHeadAttentionImpl::forward(torch::Tensor x) {
 
     torch::Tensor attn_output_ntc;
 #if defined USE_GPU && ((TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR >= 4) || TORCH_VERSION_MAJOR >= 3)
-    if (use_flash) {
+    if (use_flash && x.is_cuda()) {
         float softmax_scale = 1.0 / std::sqrt(head_dim);
 
         auto qkv_chunks = qkv.chunk(3, 2);
@@ -259,7 +349,18 @@ torch::Tensor MultiHeadAttentionImpl::forward(torch::Tensor x) {
         attn_output_ntc = std::get<0>(flash_res).reshape({N, T, C});
     } else
 #endif
-    {
+    if (use_window_attention_cpu(qkv)) {
+        attn_output_ntc = torch::empty({N, T, C}, x.options());
+        const float *qkv_ptr = qkv.data_ptr<float>();
+        float *out_ptr = attn_output_ntc.data_ptr<float>();
+        const int64_t n_items = N * nhead * div_round_up(T, int64_t{ATTN_Q_BLOCK});
+        at::parallel_for(0, n_items, 1, [&](int64_t begin, int64_t end) {
+            window_attention_cpu(
+                qkv_ptr, out_ptr, begin, end, T, nhead, head_dim, win_upper, win_lower,
+                qkv.stride(0), qkv.stride(1), qkv.stride(2), qkv.stride(3)
+            );
+        });
+    } else {
         qkv = qkv.permute({2, 0, 3, 1, 4}); // N T 3 H D -> 3 N H T D
         attn_output_ntc = torch::empty({N, T, C}, x.options());
         auto attn_window_mask = get_attn_window_mask(T);
@@ -287,13 +388,13 @@ torch::Tensor MultiHeadAttentionImpl::forward(torch::Tensor x) {
         }
     }
 
-    torch::cuda::synchronize(device_idx);
+    synchronize(device);
     b = realtime();
     model_stats->time_sdp_attn += b-a;
 
     a = realtime();
-    x = out_proj(attn_output_ntc);
-    torch::cuda::synchronize(device_idx);
+    x = packed_linear(out_proj_packed, out_proj, attn_output_ntc);
+    synchronize(device);
     b = realtime();
     model_stats->time_out_proj += b-a;
     
@@ -305,13 +406,34 @@ TxEncoderImpl::TxEncoderImpl(const TxEncoderParams &params_, const torch::Tensor
     ff = register_module("ff", GatedMLP(params.d_model, params.dim_feedforward));
     norm1 = register_module("norm1", RMSNorm(params.d_model));
     norm2 = register_module("norm2", RMSNorm(params.d_model));
-    device_idx = options.device_index();
+    device = options.device();
     model_stats = _model_stats;
 
     const torch::Tensor deepnorm_alpha = torch::tensor(params.deepnorm_alpha);
     register_buffer("deepnorm_alpha", deepnorm_alpha);
 };
 
+// alpha-scaled residual add, RMS and weight multiply in a single pass over the activation
+static torch::Tensor fused_deepnorm_rms_norm(const torch::Tensor &in, const torch::Tensor &residual, const torch::Tensor &weight, float alpha, float eps) {
+    const torch::Tensor in_c = in.contiguous();
+    const torch::Tensor residual_c = residual.contiguous();
+    const torch::Tensor weight_c = weight.contiguous();
+    torch::Tensor out = torch::empty_like(in_c);
+
+    const int dim = in_c.size(-1);
+    const int64_t rows = in_c.numel() / dim;
+    const float *in_ptr = in_c.data_ptr<float>();
+    const float *residual_ptr = residual_c.data_ptr<float>();
+    const float *weight_ptr = weight_c.data_ptr<float>();
+    float *out_ptr = out.data_ptr<float>();
+
+    at::parallel_for(0, rows, 64, [&](int64_t begin, int64_t end) {
+        deepnorm_rms_norm_cpu(in_ptr, residual_ptr, weight_ptr, out_ptr, begin, end, dim, alpha, eps);
+    });
+
+    return out;
+}
+
 torch::Tensor TxEncoderImpl::forward(torch::Tensor x) {
     torch::Tensor attn, f;
     const auto deepnorm_alpha = named_buffers()["deepnorm_alpha"];
@@ -319,37 +441,43 @@ torch::Tensor TxEncoderImpl::forward(torch::Tensor x) {
     double a, b;
 
     auto run_norm = [&](RMSNorm &norm, const torch::Tensor &in, at::Tensor &weight) {
+        if (in.device().is_cpu() && in.scalar_type() == torch::kFloat32) {
+            x = fused_deepnorm_rms_norm(in, x, weight, params.deepnorm_alpha, norm->eps);
+            return;
+        }
         auto k = in + (x * deepnorm_alpha);
 #if defined USE_GPU && ((TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR >= 9) || TORCH_VERSION_MAJOR >= 3)
-        auto eps = 1e-5f;
-        auto t0 = at::_fused_rms_norm(k, {k.size(2)}, weight, eps);
-        x = std::get<0>(t0);
-#else
-        x = norm(k);
+        if (k.is_cuda()) {
+            auto eps = 1e-5f;
+            auto t0 = at::_fused_rms_norm(k, {k.size(2)}, weight, eps);
+            x = std::get<0>(t0);
+            return;
+        }
 #endif
+        x = norm(k);
     };
 
     a = realtime();
     attn = self_attn(x);
-    torch::cuda::synchronize(device_idx);
+    synchronize(device);
     b = realtime();
     model_stats->time_self_attn += b-a;
 
     a = realtime();
     run_norm(norm1, attn, norm1->weight);
-    torch::cuda::synchronize(device_idx);
+    synchronize(device);
     b = realtime();
     model_stats->time_norm1 += b-a;
 
     a = realtime();
     f = ff(x);
-    torch::cuda::synchronize(device_idx);
+    synchronize(device);
     b = realtime();
     model_stats->time_ff += b-a;
 
     a = realtime();
     run_norm(norm2, f, norm2->weight);
-    torch::cuda::synchronize(device_idx);
+    synchronize(device);
     b = realtime();
     model_stats->time_norm2 += b-a;
     
@@ -378,7 +506,7 @@ torch::Tensor LinearUpsampleImpl::forward(const torch::Tensor &x) {
     const int64_t N = x.size(0);
     const int64_t T = x.size(1);
     const int64_t C = x.size(2);
-    torch::Tensor out = linear(x).reshape({N, scale_factor * T, C});
+    torch::Tensor out = packed_linear(packed, linear, x).reshape({N, scale_factor * T, C});
     return out;
 };
 
@@ -387,12 +515,14 @@ LinearScaledCRFImpl::LinearScaledCRFImpl(const CRFEncoderParams &params) {
     linear = register_module("linear", Linear(LinearOptions(m_params.insize, m_params.outsize()).bias(false)));
 };
 
+void LinearScaledCRFImpl::apply_scale() {
+    // out of place, the weight may be a read-only shared mapping
+    torch::NoGradGuard no_grad;
+    linear->weight.set_data(linear->weight * m_params.scale);
+}
+
 torch::Tensor LinearScaledCRFImpl::forward(const torch::Tensor &x) {
-    if (!scale_applied) {
-        linear->weight *= m_params.scale;
-        scale_applied = true;
-    }
-    return linear(x);
+    return packed_linear(packed, linear, x);
 }
 
 TxModelImpl::TxModelImpl(const CRFModelConfig &config, const torch::TensorOptions &options, tx_stats_t *_model_stats, bool use_flash) : m_options(options) {
@@ -403,41 +533,50 @@ TxModelImpl::TxModelImpl(const CRFModelConfig &config, const torch::TensorOption
     model_stats = _model_stats;
 }
 
+void TxModelImpl::prepack_weights(int64_t batch_size, int64_t chunk_size) {
+    const int64_t rows = batch_size * convs->output_length(chunk_size);
+    for (auto &layer : tx_encoder->layer_vec) {
+        prepack_linear(layer->self_attn->wqkv_packed, layer->self_attn->wqkv, rows);
+        prepack_linear(layer->self_attn->out_proj_packed, layer->self_attn->out_proj, rows);
+        prepack_linear(layer->ff->fc1_packed, layer->ff->fc1, GATED_MLP_TILE);
+        prepack_linear(layer->ff->fc2_packed, layer->ff->fc2, GATED_MLP_TILE);
+    }
+    prepack_linear(tx_decoder->packed, tx_decoder->linear, rows);
+    prepack_linear(crf->packed, crf->linear, rows * tx_decoder->scale_factor);
+}
+
 torch::Tensor TxModelImpl::forward(const torch::Tensor &chunk_NCT) {
     torch::Tensor h;
     double a, b;
-    auto device_idx = m_options.device_index();
+    const auto device = m_options.device();
 
-#ifdef USE_GPU
-#ifdef HAVE_CUDA
-    c10::cuda::CUDAGuard device_guard(device_idx);
-#endif
-#ifdef HAVE_ROCM
-    c10::hip::HIPGuard device_guard(device_idx);
-#endif
-#endif
+    // no guard for the CPU runner, GPU builds may run on hosts without a GPU
+    c10::OptionalDeviceGuard device_guard;
+    if (!device.is_cpu()) {
+        device_guard.reset_device(device);
+    }
 
     a = realtime();
     h = convs->forward(chunk_NCT);
-    torch::cuda::synchronize(device_idx);
+    synchronize(device);
     b = realtime();
     model_stats->time_conv_stack += b-a;
     
     a = realtime();
     h = tx_encoder(h);
-    torch::cuda::synchronize(device_idx);
+    synchronize(device);
     b = realtime();
     model_stats->time_tx_encoder += b-a;
 
     a = realtime();
     h = tx_decoder(h);
-    torch::cuda::synchronize(device_idx);
+    synchronize(device);
     b = realtime();
     model_stats->time_tx_decoder += b-a;
 
     a = realtime();
     h = crf(h);
-    torch::cuda::synchronize(device_idx);
+    synchronize(device);
     b = realtime();
     model_stats->time_crf += b-a;
 
@@ -632,12 +771,23 @@ std::vector<torch::Tensor> load_tx_model_weights(const std::string &dir) {
     return load_tensors(dir, tensors);
 }
 
-ModuleHolder<AnyModule> load_tx_model(const CRFModelConfig &model_config, const torch::TensorOptions &options, tx_stats_t *model_stats, bool use_flash) {
+ModuleHolder<AnyModule> load_tx_model(const CRFModelConfig &model_config, const torch::TensorOptions &options, tx_stats_t *model_stats, bool use_flash, bool share_weights, int64_t batch_size, int64_t chunk_size) {
     auto model = TxModel(model_config, options, model_stats, use_flash);
     auto state_dict = load_tx_model_weights(model_config.model_path);
-    model->load_state_dict(state_dict);
+    const bool shared = share_weights && can_share_weights(model_config.model_path, state_dict, options);
+    if (shared) {
+        module_share_state_dict(*model, state_dict);
+    } else {
+        model->load_state_dict(state_dict);
+    }
     model->to(options.dtype().toScalarType());
     model->to(options.device());
+    // in the runner's type and on its device, same rounding as scaling on the first forward
+    model->crf->apply_scale();
+    // packed copies are private to the runner, which is what shared weights avoid
+    if (!shared && options.device().is_cpu()) {
+        model->prepack_weights(batch_size, chunk_size);
+    }
     model->eval();
 
     if (use_flash) {
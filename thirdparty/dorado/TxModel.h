@@ -18,7 +18,8 @@
 
 using namespace torch::nn;
 
-ModuleHolder<AnyModule> load_tx_model(const CRFModelConfig &model_config, const torch::TensorOptions &options, tx_stats_t *model_stats, bool use_flash);
+// batch_size and chunk_size give the GEMM shapes CPU weights are prepacked for
+ModuleHolder<AnyModule> load_tx_model(const CRFModelConfig &model_config, const torch::TensorOptions &options, tx_stats_t *model_stats, bool use_flash, bool share_weights, int64_t batch_size, int64_t chunk_size);
 
 torch::Tensor scaled_dot_product_attention_naive(
     const torch::Tensor &q,
@@ -42,11 +43,13 @@ struct GatedMLPImpl : torch::nn::Module {
     GatedMLPImpl(int in_features, int hidden_features);
 
     torch::Tensor forward(const torch::Tensor &x);
+    torch::Tensor forward_fused_cpu(const torch::Tensor &x);
 
     bool features_interleaved = false;
     int in_features;
     int hidden_features;
     torch::nn::Linear fc1{nullptr}, fc2{nullptr};
+    PackedLinearWeight fc1_packed, fc2_packed; // for GATED_MLP_TILE rows, the fused path's GEMM shape
 };
 
 TORCH_MODULE(GatedMLP);
@@ -108,6 +111,7 @@ struct MultiHeadAttentionImpl : torch::nn::Module {
     std::unordered_map<MaskKey, torch::Tensor, MaskKeyHash> mask_cache{};
 
     torch::nn::Linear wqkv{nullptr}, out_proj{nullptr};
+    PackedLinearWeight wqkv_packed, out_proj_packed;
     RotaryEmbedding rotary_emb{nullptr};
 
     tx_stats_t *model_stats;
@@ -129,7 +133,7 @@ struct TxEncoderImpl : torch::nn::Module {
     RMSNorm norm1{nullptr}, norm2{nullptr};
 
     tx_stats_t *model_stats;
-    int device_idx;
+    torch::Device device{torch::kCPU};
 };
 
 TORCH_MODULE(TxEncoder);
@@ -153,6 +157,7 @@ struct LinearUpsampleImpl : torch::nn::Module {
 
     const int scale_factor;
     torch::nn::Linear linear{nullptr};
+    PackedLinearWeight packed;
 };
 
 TORCH_MODULE(LinearUpsample);
@@ -160,10 +165,13 @@ TORCH_MODULE(LinearUpsample);
 struct LinearScaledCRFImpl : torch::nn::Module {
     LinearScaledCRFImpl(const CRFEncoderParams &params);
 
+    // scales the weight once when the model is loaded
+    void apply_scale();
+
     torch::Tensor forward(const torch::Tensor &x);
 
-    bool scale_applied = false;
     torch::nn::Linear linear{nullptr};
+    PackedLinearWeight packed;
     CRFEncoderParams m_params;
 };
 
@@ -175,6 +183,7 @@ struct TxModelImpl : torch::nn::Module {
     void load_state_dict(const std::vector<torch::Tensor> &weights) {
         module_load_state_dict(*this, weights);
     }
+    void prepack_weights(int64_t batch_size, int64_t chunk_size);
 
     torch::Tensor forward(const torch::Tensor &chunk_NCT);
 
@@ -1,6 +1,7 @@
 #include "toml.h"
 #include "error.h"
 #include "model_config.h"
+#include "model_pack.h"
 
 #include <unordered_map>
 
@@ -364,23 +365,39 @@ CRFEncoderParams parse_crf_encoder_params(toml_table_t *cfg) {
     return params;
 }
 
-CRFModelConfig load_lstm_model_config(const char *path) {
-    FILE* fp;
+// parse config.toml of a model directory, or the copy embedded in a model pack
+// cpath is set to where the config came from for messages
+static toml_table_t *parse_model_config(const char *path, std::string &cpath) {
     char errbuf[200];
-
-    char *cpath = (char *)malloc(strlen(path) + 100);
-    MALLOC_CHK(cpath);
-    sprintf(cpath, "%s/config.toml", path);
-
-    fp = fopen(cpath, "r");
-    if (!fp) {
-        ERROR("cannot open toml - %s: %s", cpath, strerror(errno));
+    toml_table_t *config_toml = NULL;
+
+    model_pack_t *pack = model_pack_get(path);
+    if (pack) {
+        cpath = std::string(path) + ":config.toml";
+        // toml_parse may write to the text, parse a copy
+        std::string conf((const char *)pack->base + pack->header->config_offset, pack->header->config_len);
+        config_toml = toml_parse(&conf[0], errbuf, sizeof(errbuf));
+    } else {
+        cpath = std::string(path) + "/config.toml";
+        FILE *fp = fopen(cpath.c_str(), "r");
+        if (!fp) {
+            ERROR("cannot open toml - %s: %s", cpath.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        config_toml = toml_parse_file(fp, errbuf, sizeof(errbuf));
+        fclose(fp);
+    }
+    if (!config_toml) {
+        ERROR("cannot parse toml - %s: %s", cpath.c_str(), errbuf);
         exit(EXIT_FAILURE);
     }
 
-    toml_table_t *config_toml = toml_parse_file(fp, errbuf, sizeof(errbuf));
-    fclose(fp);
-    check_toml_table(config_toml);
+    return config_toml;
+}
+
+CRFModelConfig load_lstm_model_config(const char *path) {
+    std::string cpath;
+    toml_table_t *config_toml = parse_model_config(path, cpath);
 
     CRFModelConfig config;
     config.has_out_features = false;
@@ -491,28 +508,13 @@ CRFModelConfig load_lstm_model_config(const char *path) {
 
     toml_free(config_toml);
 
-    free(cpath);
 
     return config;
 }
 
 CRFModelConfig load_tx_model_config(const char *path) {
-    FILE* fp;
-    char errbuf[200];
-
-    char *cpath = (char *)malloc(strlen(path) + 100);
-    MALLOC_CHK(cpath);
-    sprintf(cpath, "%s/config.toml", path);
-
-    fp = fopen(cpath, "r");
-    if (!fp) {
-        ERROR("cannot open toml - %s: %s", cpath, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-
-    toml_table_t *config_toml = toml_parse_file(fp, errbuf, sizeof(errbuf));
-    fclose(fp);
-    check_toml_table(config_toml);
+    std::string cpath;
+    toml_table_t *config_toml = parse_model_config(path, cpath);
     toml_table_t *model_toml = toml_table_in(config_toml, "model");
     check_toml_table(model_toml);
 
@@ -571,35 +573,20 @@ CRFModelConfig load_tx_model_config(const char *path) {
 
     toml_free(config_toml);
 
-    free(cpath);
 
     return config;
 }
 
 bool is_tx_model_config(const char *path) {
-    FILE* fp;
-    char errbuf[200];
-
-    char *cpath = (char *)malloc(strlen(path) + 100);
-    MALLOC_CHK(cpath);
-    sprintf(cpath, "%s/config.toml", path);
-
-    fp = fopen(cpath, "r");
-    if (!fp) {
-        ERROR("cannot open toml - %s: %s", cpath, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-    toml_table_t *config_toml = toml_parse_file(fp, errbuf, sizeof(errbuf));
-    fclose(fp);
-    check_toml_table(config_toml);
+    std::string cpath;
+    toml_table_t *config_toml = parse_model_config(path, cpath);
 
     bool is_tx_model = toml_key_fallback(config_toml, {"model", "encoder", "transformer_encoder"});
     if (is_tx_model) {
-        INFO("transformer model detected for config at: %s", cpath);
+        INFO("transformer model detected for config at: %s", cpath.c_str());
     }
 
     toml_free(config_toml);
-    free(cpath);
 
     return is_tx_model;
 }
@@ -1,12 +1,16 @@
 
 #include <cstdint>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <numeric>
 #include <string>
 #include <utility>
 
+#include <ATen/core/dispatch/Dispatcher.h>
+
 #include "error.h"
+#include "model_pack.h"
 #include "tensor_chunk_utils.h"
 
 #define EPS (1e-9f)
@@ -121,7 +125,7 @@ int determine_rna_adapter_pos(torch::Tensor &signal) {
     return break_point;
 }
 
-void scale_signal(core_t *core, torch::Tensor &signal, float scaling, float offset, SignalNormalisationParams &scaling_params) {
+int scale_signal(core_t *core, torch::Tensor &signal, float scaling, float offset, SignalNormalisationParams &scaling_params) {
     auto strategy = scaling_params.strategy;
     float scale = 1.0f;
     float shift = 0.0f;
@@ -181,57 +185,177 @@ void scale_signal(core_t *core, torch::Tensor &signal, float scaling, float offs
 
         if ((size_t)(trim_start) < (size_t)(signal.size(0))) {
             signal = signal.index({Slice(trim_start, torch::indexing::None)});
+        } else {
+            trim_start = 0;
         }
     }
+
+    return trim_start;
 }
 
 int div_round_closest(const int n, const int d) {
     return ((n < 0) ^ (d < 0)) ? ((n - d/2)/d) : ((n + d/2)/d);
 }
 
-void stitch_chunks(chunk_db_t *chunk_db, size_t i, std::string &sequence, std::string &qstring) {
-    std::vector<chunk_res> &chunks = (*chunk_db->chunks_res)[i];
-    // Calculate the chunk down sampling, round to closest int.
-    int down_sampling = div_round_closest(chunks[0].raw_chunk_size, chunks[0].moves.size());
-
-    int start_pos = 0;
-    std::vector<std::string> sequences;
-    std::vector<std::string> qstrings;
-    for (size_t i = 0; i < chunks.size() - 1; i++){
-        chunk_res_t &current_chunk = chunks[i];
-        chunk_res_t &next_chunk = chunks[i+1];
-        int overlap_size = (current_chunk.raw_chunk_size + current_chunk.input_offset) - (next_chunk.input_offset);
-        int overlap_down_sampled = overlap_size / down_sampling;
-        int mid_point = overlap_down_sampled / 2;
-
-        int current_chunk_bases_to_trim = 0;
-        for (int i = current_chunk.moves.size() - 1; i > (int)(current_chunk.moves.size() - mid_point); i--){
-            current_chunk_bases_to_trim += (int) current_chunk.moves[i];
+// number of bases called in the first n timesteps of a chunk
+static inline int count_bases(const uint8_t *moves, int n) {
+    int bases = 0;
+    for (int t = 0; t < n; ++t) {
+        bases += moves[t];
+    }
+    return bases;
+}
+
+// midpoint (in timesteps) of the overlap between chunk k and chunk k + 1
+static inline int overlap_mid_point(const std::vector<chunk_res_t> &chunks, size_t k, int down_sampling) {
+    const chunk_res_t &current_chunk = chunks[k];
+    const chunk_res_t &next_chunk = chunks[k + 1];
+    int overlap_size = (current_chunk.raw_chunk_size + current_chunk.input_offset) - (next_chunk.input_offset);
+    int overlap_down_sampled = overlap_size / down_sampling;
+    return overlap_down_sampled / 2;
+}
+
+// timesteps [start, end) of chunk k that make it into the read, each chunk gives up its half of every overlap
+// the sequence and the move table are both cut here, so the bases kept are exactly the moves kept
+static void chunk_timesteps(const std::vector<chunk_res_t> &chunks, size_t k, int T, int down_sampling, int *start, int *end) {
+    const chunk_res_t &chunk = chunks[k];
+
+    int s = 0;
+    if (k > 0) {
+        s = overlap_mid_point(chunks, k - 1, down_sampling);
+        s = s < T ? s : T;
+    }
+
+    int e = T;
+    if (k + 1 < chunks.size()) {
+        // the base called at the midpoint stays with this chunk, the ones after it are dropped
+        e = T - overlap_mid_point(chunks, k, down_sampling) + 1;
+        e = e > 0 ? e : 0;
+        e = e < T ? e : T;
+        if (count_bases(chunk.moves, e) < count_bases(chunk.moves, s)) { // as substr, take the rest of the chunk
+            e = T;
+        } else if (e < s) { // nothing between the midpoints
+            e = s;
         }
+    }
 
-        int current_chunk_seq_len = current_chunk.seq.size();
-        int end_pos = current_chunk_seq_len - current_chunk_bases_to_trim;
-        int trimmed_len = end_pos - start_pos;
-        sequences.push_back(current_chunk.seq.substr(start_pos, trimmed_len));
-        qstrings.push_back(current_chunk.qstring.substr(start_pos, trimmed_len));
+    *start = s;
+    *end = e;
+}
+
+// bases [start, end) of chunk k that make it into the read, the bases called within its chunk_timesteps
+static void chunk_bounds(const std::vector<chunk_res_t> &chunks, size_t k, int T, int down_sampling, int *start, int *end) {
+    const chunk_res_t &chunk = chunks[k];
+    int ts, te;
+    chunk_timesteps(chunks, k, T, down_sampling, &ts, &te);
+
+    int s = count_bases(chunk.moves, ts);
+    int e = s + count_bases(chunk.moves + ts, te - ts);
+    *start = s < chunk.num_bases ? s : chunk.num_bases;
+    *end = e < chunk.num_bases ? e : chunk.num_bases;
+}
+
+size_t stitch_chunks(chunk_db_t *chunk_db, size_t i, bool reverse, char **sequence, char **qstring) {
+    const std::vector<chunk_res_t> &chunks = (*chunk_db->chunks_res)[i];
+    const int T = chunk_db->T;
+    // Calculate the chunk down sampling, round to closest int.
+    const int down_sampling = div_round_closest(chunks[0].raw_chunk_size, T);
+
+    // first pass sizes the read exactly
+    size_t len = 0;
+    for (size_t k = 0; k < chunks.size(); ++k) {
+        int start, end;
+        chunk_bounds(chunks, k, T, down_sampling, &start, &end);
+        len += end - start;
+    }
 
-        start_pos = 0;
-        for (int i=0; i < mid_point; i++){
-            start_pos += (int) next_chunk.moves[i];
+    char *seq = (char *)malloc((len + 1) * sizeof(char));
+    MALLOC_CHK(seq);
+    char *qual = (char *)malloc((len + 1) * sizeof(char));
+    MALLOC_CHK(qual);
+
+    // second pass copies each chunk's share straight into place, back to front when reversing
+    size_t pos = 0;
+    for (size_t k = 0; k < chunks.size(); ++k) {
+        int start, end;
+        chunk_bounds(chunks, k, T, down_sampling, &start, &end);
+        const size_t n = end - start;
+        if (reverse) {
+            const char *src_seq = chunks[k].seq + start;
+            const char *src_qual = chunks[k].qstring + start;
+            for (size_t j = 0; j < n; ++j) {
+                seq[len - 1 - pos - j] = src_seq[j];
+                qual[len - 1 - pos - j] = src_qual[j];
+            }
+        } else {
+            memcpy(seq + pos, chunks[k].seq + start, n);
+            memcpy(qual + pos, chunks[k].qstring + start, n);
         }
+        pos += n;
+    }
+    seq[len] = '\0';
+    qual[len] = '\0';
+
+    *sequence = seq;
+    *qstring = qual;
+    return len;
+}
+
+size_t stitch_moves(chunk_db_t *chunk_db, size_t i, uint8_t **moves) {
+    const std::vector<chunk_res_t> &chunks = (*chunk_db->chunks_res)[i];
+    const int T = chunk_db->T;
+    const int down_sampling = div_round_closest(chunks[0].raw_chunk_size, T);
+
+    // the same timesteps the sequence was stitched from
+    size_t len = 0;
+    for (size_t k = 0; k < chunks.size(); ++k) {
+        int start, end;
+        chunk_timesteps(chunks, k, T, down_sampling, &start, &end);
+        len += end - start;
     }
 
-    //append the final read
-    sequences.push_back(chunks[chunks.size() - 1].seq.substr(start_pos));
-    qstrings.push_back(chunks[chunks.size() - 1].qstring.substr(start_pos));
+    uint8_t *mv = (uint8_t *)malloc(len * sizeof(uint8_t) + 1);
+    MALLOC_CHK(mv);
+    size_t pos = 0;
+    for (size_t k = 0; k < chunks.size(); ++k) {
+        int start, end;
+        chunk_timesteps(chunks, k, T, down_sampling, &start, &end);
+        memcpy(mv + pos, chunks[k].moves + start, end - start);
+        pos += end - start;
+    }
+
+    *moves = mv;
+    return len;
+}
 
-    // Set the read seq and qstring
-    sequence = std::accumulate(sequences.begin(), sequences.end(), std::string(""));
-    qstring = std::accumulate(qstrings.begin(), qstrings.end(), std::string(""));
+static torch::ScalarType model_pack_dtype(uint32_t dtype) {
+    switch (dtype) {
+        case MODEL_PACK_F32: return torch::kFloat32;
+        case MODEL_PACK_F16: return torch::kFloat16;
+    }
+    ERROR("unknown tensor type %u in model pack", dtype);
+    exit(EXIT_FAILURE);
 }
 
 std::vector<torch::Tensor> load_tensors(const std::string& dir, const std::vector<std::string>& tensors) {
     auto weights = std::vector<torch::Tensor>();
+
+    // a model pack is mapped once and its tensors are read in place, no deserialisation
+    model_pack_t *pack = model_pack_get(dir.c_str());
+    if (pack) {
+        for (auto tensor : tensors) {
+            const model_pack_entry_t *entry = model_pack_find(pack, tensor.c_str());
+            if (entry == NULL) {
+                ERROR("tensor %s not found in model pack %s", tensor.c_str(), dir.c_str());
+                exit(EXIT_FAILURE);
+            }
+            std::vector<int64_t> shape(entry->shape, entry->shape + entry->ndim);
+            // the mapping is read-only, these tensors are copied from or shared but never written
+            weights.push_back(torch::from_blob(pack->base + entry->offset, shape, torch::TensorOptions().dtype(model_pack_dtype(entry->dtype))));
+        }
+        return weights;
+    }
+
     for (auto tensor : tensors) {
         auto path = dir + "/" + tensor;
         torch::load(weights, path);
@@ -240,6 +364,60 @@ std::vector<torch::Tensor> load_tensors(const std::string& dir, const std::vecto
     return weights;
 }
 
+bool can_share_weights(const std::string& dir, const std::vector<torch::Tensor>& weights, const torch::TensorOptions& options) {
+    if (model_pack_get(dir.c_str()) == NULL) {
+        WARNING("%s is not a model pack, weights are copied", dir.c_str());
+        return false;
+    }
+    if (!options.device().is_cpu()) {
+        WARNING("%s", "weights can only be shared by CPU runners, weights are copied");
+        return false;
+    }
+    for (auto &w : weights) {
+        if (w.scalar_type() != options.dtype().toScalarType()) {
+            WARNING("model pack %s holds %s weights but the model runs in %s, weights are copied", dir.c_str(),
+                    c10::toString(w.scalar_type()), c10::toString(options.dtype().toScalarType()));
+            return false;
+        }
+    }
+    return true;
+}
+
+// registered by libtorch only when it is built with MKL and oneDNN, looked up at runtime so that other builds still link
+static const c10::optional<c10::OperatorHandle> &mkl_reorder_op() {
+    static const c10::optional<c10::OperatorHandle> op = c10::Dispatcher::singleton().findSchema({"mkl::_mkl_reorder_linear_weight", ""});
+    return op;
+}
+
+static const c10::optional<c10::OperatorHandle> &mkl_linear_op() {
+    static const c10::optional<c10::OperatorHandle> op = c10::Dispatcher::singleton().findSchema({"mkl::_mkl_linear", ""});
+    return op;
+}
+
+void prepack_linear(PackedLinearWeight &packed, const torch::nn::Linear &linear, int64_t rows) {
+    packed.weight = torch::Tensor();
+    packed.rows = 0;
+    const torch::Tensor &weight = linear->weight;
+    if (!mkl_reorder_op() || !mkl_linear_op() || rows < 1 || !weight.device().is_cpu() || weight.scalar_type() != torch::kFloat32) {
+        return;
+    }
+    torch::NoGradGuard no_grad;
+    packed.weight = mkl_reorder_op()->typed<at::Tensor(const at::Tensor &, int64_t)>().call(weight.contiguous(), rows);
+    packed.rows = rows;
+}
+
+torch::Tensor packed_linear(const PackedLinearWeight &packed, torch::nn::Linear &linear, const torch::Tensor &x) {
+    if (!packed.weight.defined() || x.numel() / x.size(-1) != packed.rows) {
+        return linear(x);
+    }
+    c10::optional<at::Tensor> bias;
+    if (linear->bias.defined()) {
+        bias = linear->bias;
+    }
+    return mkl_linear_op()->typed<at::Tensor(const at::Tensor &, const at::Tensor &, const at::Tensor &, const c10::optional<at::Tensor> &, int64_t)>()
+        .call(x, packed.weight, linear->weight, bias, packed.rows);
+}
+
 torch::Tensor quantile(const torch::Tensor t, const torch::Tensor q) {
     assert(q.dtype() == torch::kF32);
 
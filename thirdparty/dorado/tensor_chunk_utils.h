@@ -18,14 +18,36 @@ T pad_to(const T a, const T b) {
     return div_round_up(a, b) * b;
 }
 
-void scale_signal(core_t *core, torch::Tensor &signal, float scaling, float offset, SignalNormalisationParams &scaling_params);
+// Scales the signal in place and trims its start, returns the number of samples trimmed.
+int scale_signal(core_t *core, torch::Tensor &signal, float scaling, float offset, SignalNormalisationParams &scaling_params);
 
-// Given a read with unstitched chunks, stitch the chunks (accounting for overlap) and assign basecalled read and qstring to Read
-void stitch_chunks(chunk_db_t *chunk_db, size_t i, std::string &sequence, std::string &qstring);
+// Given a read with unstitched chunks, stitch the chunks (accounting for overlap) into freshly malloc'd, null terminated
+// sequence and qstring buffers of exactly the read length (reversed if requested), returns the read length
+size_t stitch_chunks(chunk_db_t *chunk_db, size_t i, bool reverse, char **sequence, char **qstring);
 
-// Load serialised tensor from disk.
+// The move table of the same read in signal order, stitched at the same overlap midpoints, returns its length.
+size_t stitch_moves(chunk_db_t *chunk_db, size_t i, uint8_t **moves);
+
+// Load serialised tensor from disk, dir is either a model directory or a model pack.
 std::vector<torch::Tensor> load_tensors(const std::string& dir, const std::vector<std::string>& tensors);
 
+// whether the weights load_tensors returned for dir can back the parameters of a model with these options as they are
+// (mapped from a model pack, on the CPU and already of the model's type)
+bool can_share_weights(const std::string& dir, const std::vector<torch::Tensor>& weights, const torch::TensorOptions& options);
+
+// A Linear weight reordered once into the blocked layout the CPU GEMM backend (MKL) consumes directly.
+// The layout is tied to the number of input rows it was packed for, other row counts use the plain weight.
+struct PackedLinearWeight {
+    torch::Tensor weight;   // opaque packed weight, undefined when not packed
+    int64_t rows = 0;
+};
+
+// pack a float32 CPU Linear for inputs of rows rows, leaves packed undefined if libtorch was built without MKL
+void prepack_linear(PackedLinearWeight &packed, const torch::nn::Linear &linear, int64_t rows);
+
+// linear(x), through the packed weight when x has the rows it was packed for
+torch::Tensor packed_linear(const PackedLinearWeight &packed, torch::nn::Linear &linear, const torch::Tensor &x);
+
 // Computes the q-th quantiles of each row of the input tensor `t`
 // using a partial sort as opposed a full sort per torch::quantiles
 // Only `interpolation='lower'` is currently implemented.
@@ -44,4 +66,15 @@ inline void module_load_state_dict(torch::nn::Module& module, const std::vector<
     }
 }
 
+// parameters become views of the weights instead of copies, used for read-only weights mapped from a model pack
+// the module must never write to its parameters afterwards
+inline void module_share_state_dict(torch::nn::Module& module, const std::vector<torch::Tensor>& weights) {
+    auto params = module.parameters();
+    assert(weights.size() == params.size());
+    for (size_t idx = 0; idx < weights.size(); idx++) {
+        assert(params[idx].sizes() == weights[idx].sizes());
+        params[idx].set_data(weights[idx]);
+    }
+}
+
 #endif